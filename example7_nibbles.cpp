@@ -2,7 +2,6 @@
 #define IMM2D_IMPLEMENTATION
 #include "immediate2d.h"
 
-#include <numeric>
 #include <string>
 #include <deque>
 using namespace std;
@@ -51,33 +50,11 @@ Color GetBigPixel(int x, int y)
     return ReadPixel(x * 2, y * 2 + 10);
 }
 
-// For a line-by-line breakdown of this single-function text rendering library,
-// see the Text example.  (This version has been compacted and is a bit terse.)
+// This uses the same little font that the Text example builds by hand, which
+// comes built into Immediate2D as "PixelFont"
 void DrawString(int x, int y, const string &s, Color c, bool centered = false)
 {
-    static constexpr uint32_t Font[128 - 32] = {
-        0x10000000, 0x10000017, 0x30000C03, 0x50AFABEA, 0x509AFEB2, 0x30004C99, 0x400A26AA, 0x10000003, 0x2000022E, 0x200001D1, 0x30001445, 0x300011C4, 0x10000018, 0x30001084, 0x10000010, 0x30000C98,
-        0x30003A2E, 0x300043F2, 0x30004AB9, 0x30006EB1, 0x30007C87, 0x300026B7, 0x300076BF, 0x30007C21, 0x30006EBB, 0x30007EB7, 0x1000000A, 0x1000001A, 0x30004544, 0x4005294A, 0x30001151, 0x30000AA1,
-        0x506ADE2E, 0x300078BE, 0x30002ABF, 0x3000462E, 0x30003A3F, 0x300046BF, 0x300004BF, 0x3000662E, 0x30007C9F, 0x1000001F, 0x30003E08, 0x30006C9F, 0x3000421F, 0x51F1105F, 0x51F4105F, 0x4007462E,
-        0x300008BF, 0x400F662E, 0x300068BF, 0x300026B2, 0x300007E1, 0x30007E1F, 0x30003E0F, 0x50F8320F, 0x30006C9B, 0x30000F83, 0x30004EB9, 0x2000023F, 0x30006083, 0x200003F1, 0x30000822, 0x30004210,
-        0x20000041, 0x300078BE, 0x30002ABF, 0x3000462E, 0x30003A3F, 0x300046BF, 0x300004BF, 0x3000662E, 0x30007C9F, 0x1000001F, 0x30003E08, 0x30006C9F, 0x3000421F, 0x51F1105F, 0x51F4105F, 0x4007462E,
-        0x300008BF, 0x400F662E, 0x300068BF, 0x300026B2, 0x300007E1, 0x30007E1F, 0x30003E0F, 0x50F8320F, 0x30006C9B, 0x30000F83, 0x30004EB9, 0x30004764, 0x1000001F, 0x30001371, 0x50441044, 0x00000000,
-    };
-
-    if (centered) x -= accumulate(s.begin(), s.end(), 0, [](int a, char b) { return a + (b < 32 ? 0 : (Font[b - 32] >> 28) + 1); }) / 2;
-
-    for (auto i : s)
-    {
-        if (i < 32 || i > 127) continue;
-        uint32_t glyph = Font[i - 32];
-        const int width = glyph >> 28;
-        for (int u = x; u < x + width; ++u)
-            for (int v = y; v < y + 5; ++v, glyph = glyph >> 1)
-                if ((glyph & 1) == 1)
-                    DrawPixel(u, v, c);
-
-        if (width > 0) x += width + 1;
-    }
+    DrawString(x, y, s.c_str(), PixelFont, 5, c, centered);
 }
 
 
@@ -171,6 +171,10 @@ void run()
 {
     UseDoubleBuffering(true);
 
+    // Lets each OpenMP thread keep its own list of pixels until Present(),
+    // instead of every thread waiting in line to draw each one
+    UseDeferredDrawing(true);
+
     Ray cam{ Vec(50, 50, 295.6), Vec(0, -0.04, -1).norm() }; // cam pos, dir
     Vec cx = Vec(Width*.5135 / Height);
     Vec cy = (cx % cam.d).norm()*.5135;
@@ -193,8 +193,9 @@ void run()
     int levelNumber{};
     for (const auto &text : LevelList) void(Level(text, ++levelNumber));
 
-    std::vector<Image> images;
-    for (auto *name : ImageResourceNames) images.push_back(LoadImage(name));
+    // LoadImages loads the whole list at once (using every core in your computer)
+    std::vector<Image> images(sizeof(ImageResourceNames) / sizeof(ImageResourceNames[0]));
+    LoadImages(ImageResourceNames, (int)images.size(), images.data());
 
     // There is a crude level editor built in.  Activate it with the backtick
     // key (`).  Move your mouse over a tile, and press a character matching
@@ -233,7 +234,11 @@ void run()
 
             Clear();
 
-            // Map housekeeping and drawing.
+            // Map housekeeping and drawing.  The whole map is drawn with a
+            // single DrawSprites call at the end, which is much faster than
+            // calling DrawImage for every tile.
+            std::vector<SpriteInstance> tiles;
+            tiles.reserve(TileW * TileH);
             for (int y = 0; y < TileH; ++y)
             for (int x = 0; x < TileW; ++x)
             {
@@ -254,8 +259,9 @@ void run()
                     level.map[y][x] = Floor;
                 }
 
-                DrawImage(x * TileS, y * TileS, images[tile]);
+                tiles.push_back({ x * TileS, y * TileS, images[tile] });
             };
+            DrawSprites(tiles.data(), (int)tiles.size());
 
             const char c = LastBufferedKey();
             const int playerDx = (c == Right) - (c == Left);
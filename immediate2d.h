@@ -85,6 +85,20 @@
 //
 
 
+// ADVANCED!  If you'd like to run your program somewhere without a screen
+// (like a Linux server, or an automated build that renders test images),
+// add one more #define before IMM2D_IMPLEMENTATION:
+//
+// #define IMM2D_HEADLESS
+//
+// Instead of opening a window, Immediate2D draws into a plain block of
+// memory and calls your run() function on its own thread, just like usual.
+// When run() returns (or you call CloseWindow) the program ends.  Use
+// SaveImage to see what you drew.  There is no keyboard, mouse, or music,
+// so those functions simply report that nothing is happening.
+//
+
+
 
 ///////////////////////////////////////////////////////////////////////////////
 // Color
@@ -98,6 +112,13 @@ using Color = unsigned int;
 // The red, green, and blue parameters are color intensities between 0 and 255.
 constexpr Color MakeColor(int red, int green, int blue);
 
+// The same, but with an "alpha" value: how solid the color is, from 0 (which
+// is completely invisible, like Transparent) to 255 (completely solid, which
+// is what the version above always makes).  Anything in between lets whatever
+// is underneath show through, like tinted glass.  That works with every one
+// of the drawing functions, including DrawPixel.
+constexpr Color MakeColor(int red, int green, int blue, int alpha);
+
 // Here are some colors to get you started.
 static const Color Transparent =  0U;
 static const Color Black =        MakeColor(  0,   0,   0);
@@ -166,7 +187,8 @@ static constexpr double Degrees(double radians) { return radians * 360.0 / Tau;
 // classes and can be a little tricky to get used to!)
 
 
-// Draws a single dot at (x, y) in the given color.
+// Draws a single dot at (x, y) in the given color.  (See-through colors made
+// with MakeColor's alpha are mixed with the color that was already there.)
 void DrawPixel(int x, int y, Color c);
 
 // Draws a line from (x1, y1) to (x2, y2) with a given stroke thickness
@@ -178,6 +200,10 @@ void DrawLine(int x1, int y1, int x2, int y2, int thickness, Color c);
 // with that color.  The stroke color will be used to draw a single pixel
 // border.  To skip drawing either the border or filling the inside, set that
 // color to Transparent.
+//
+// Either way, the rectangle covers exactly width*height pixels: from (x, y)
+// to (x + width - 1, y + height - 1).  The border is drawn on the outermost
+// pixels of that area, not around the outside of it.
 void DrawRectangle(int x, int y, int width, int height, Color fill, Color stroke = Transparent);
 
 // Draws a circle centered at (x, y) with a given radius (in pixels).  Specify
@@ -195,6 +221,30 @@ void DrawArc(int x, int y, float radius, float thickness, Color stroke, float st
 // left-justified but can be horizontally centered on x by passing true for centered.
 void DrawString(int x, int y, const char *text, const char *fontName, int fontSizePt, const Color c, bool centered = false);
 
+// The name of a tiny font that's built into Immediate2D, for use with DrawString.
+// Its letters are 5 pixels tall at size 5 (or 10 pixels tall at size 10, etc.)
+// and it only has the characters you can type on a US keyboard, but it's much
+// faster than the other fonts and looks exactly the same on every computer.
+static constexpr const char *PixelFont = "imm2d-5px";
+
+// Returns how wide (in pixels) DrawString would make this text with the given
+// font and size.  If the text has more than one line, this is the widest one.
+int MeasureString(const char *text, const char *fontName, int fontSizePt);
+
+// Immediate2D remembers how the last few hundred strings it drew were laid out,
+// so text that's drawn the same way every frame (like a score or a menu) gets
+// to skip most of the work after the first time.  This reports how many times
+// that worked ("hits"), how many times a string had to be laid out from scratch
+// ("misses"), and how many strings are remembered right now ("entries").
+struct CacheStats { long long hits, misses; int entries; };
+CacheStats TextCacheStats();
+
+// These draw text with PixelFont (at size 5) into your own list of numbers or
+// colors instead of the screen, setting the ones under each letter to "value"
+// or "c".  The list should hold width*height of them, one row after another.
+void DrawString(float *values, int width, int height, int x, int y, const char *text, float value, bool centered = false);
+void DrawString(Color *colors, int width, int height, int x, int y, const char *text, Color c, bool centered = false);
+
 
 // Clears the screen to the given color (or Black if no color passed in).
 void Clear(Color c = Black);
@@ -211,7 +261,9 @@ using Image = int;
 const static Image InvalidImage = -1;
 
 // Attempts to load and return an Image handle that can be used
-// with DrawImage.  Many image file extensions are supported.
+// with DrawImage.  Many image file extensions are supported: .png, .gif
+// (including animated ones), and .bmp work everywhere, and on Windows, so
+// does anything else Windows knows how to open (like .jpg).
 //
 // To find the image you requested, the following locations are
 // searched, in this order:
@@ -222,12 +274,40 @@ const static Image InvalidImage = -1;
 // If the image wasn't found or there was some other problem loading it,
 // this function will return InvalidImage.
 //
-// Try to call this only once per file you want to load.  Keep the returned Image
-// value around instead of calling this again and again.  Images remain loaded in
-// memory until your program ends, so calling this repeatedly for the same image
-// (say, inside a loop) will continue using more memory until your app crashes.
+// Loading the same name (or the same Base64 data) again just gives back the Image
+// you got the first time, without loading anything, so that doesn't use up more
+// memory.  It's still a good habit to call this once per file and keep the Image
+// value around, though.  Images stay loaded until you call UnloadImage (or your
+// program ends).
 Image LoadImage(const char *name);
 
+// Just like LoadImage, except it gives back the Image right away and does the
+// loading in the background (on as many threads as your computer has cores), so
+// your program can keep drawing while big images are loading.
+//
+// Until the image is ready, DrawImage simply draws nothing for it and ImageWidth
+// and ImageHeight are 0.  If it can't be loaded at all, it never becomes ready
+// (and its Image value may be handed out again later), so if you need to know
+// whether a name is good, LoadImage will tell you by giving back InvalidImage.
+Image LoadImageAsync(const char *name);
+
+// Returns true once an image from LoadImageAsync has finished loading.  (Images
+// from LoadImage are always ready.)  It stays false for images that couldn't be
+// loaded, so it's a good idea to give up on waiting after a while.
+bool IsImageReady(Image i);
+
+// Loads a whole list of images at once, sharing the work between all of your
+// computer's cores, and waits for all of them to finish.  Each result is the same
+// as what LoadImage would have given back for that name (including InvalidImage):
+//     const char *names[] = { "player.png", "wall.png", "coin.gif" };
+//     Image images[3];
+//     LoadImages(names, 3, images);
+void LoadImages(const char *const *names, int count, Image *images);
+
+// Frees an image's memory when you're done with it.  Don't draw it afterward:
+// its Image value may be handed out again by a later LoadImage.
+void UnloadImage(Image i);
+
 // Draws an image (obtained using LoadImage) with its top-left corner at the
 // provided (x, y) coordinates at 100% scale.
 //
@@ -236,14 +316,47 @@ Image LoadImage(const char *name);
 // so no frames are missed.
 void DrawImage(int x, int y, Image i);
 
+// One image to draw at one place, for use with DrawSprites.
+struct SpriteInstance { int x, y; Image image; };
+
+// Draws a whole list of images at once, in order, exactly as if DrawImage had
+// been called for each of them (but quite a bit faster).  This is handy for
+// things like a tile map, where the same few images are drawn over and over:
+//     std::vector<SpriteInstance> tiles;
+//     tiles.push_back({ x * 16, y * 16, wallImage });
+//     ...
+//     DrawSprites(tiles.data(), (int)tiles.size());
+void DrawSprites(const SpriteInstance *sprites, int count);
+
 // Retrieves the width and height of an image (obtained using LoadImage).
 int ImageWidth(Image i);
 int ImageHeight(Image i);
 
+// Returns how much memory (in bytes) an image's pixels are using, counting every
+// one of its animation frames.  Pass InvalidImage to add up all of your images.
+long long ImageMemoryUsage(Image i);
+
+// OPTIONAL!  Programs that run for a long time and show lots of different images
+// can keep their memory use in check by setting a limit (in bytes) here.  Once
+// the images go over it, the ones that haven't been drawn in the longest time are
+// let go.  You can keep using them like normal: the next DrawImage starts loading
+// them again in the background, and they show up again a moment later.  (Until
+// then, drawing them does nothing.)  Use 0 for no limit (the default).
+void SetImageMemoryBudget(long long bytes);
+
+// Reports how many times LoadImage was able to give back an image that was
+// already loaded ("hits") instead of loading it ("misses"), along with how many
+// names it remembers ("entries").
+CacheStats ImageCacheStats();
+
 
 // OPTIONAL!  Anti-aliasing is a graphics technique to make your lines and
 // circles appear with smooth/soft edges.  These can be called at any time
 // to change the way the other drawing functions behave.
+//
+// Smooth edges take longer to draw than hard ones: about two or three times
+// as long for thick lines and arcs, and up to ten times as long for thin
+// lines and circle outlines.
 void UseAntiAliasing();
 void StopAntiAliasing();
 
@@ -261,6 +374,21 @@ void StopAntiAliasing();
 //
 void UseDoubleBuffering(bool enabled);
 
+// ADVANCED!  Normally, after you Present(), the back-buffer still has the
+// scene you just presented on it, so you can keep drawing on top of it.  To
+// make that work, Immediate2D has to copy the whole screen each Present().
+//
+// If your program redraws the entire screen every frame anyway (say, starting
+// with a call to Clear), you can skip that copy with Discard.  The catch: after
+// each Present(), the back-buffer will have some older frame on it instead.
+//
+//   Off       The same as UseDoubleBuffering(false)
+//   Preserve  The same as UseDoubleBuffering(true)
+//   Discard   Double buffering, without keeping the back-buffer's contents
+//
+enum class DoubleBufferMode { Off, Preserve, Discard };
+void UseDoubleBuffering(DoubleBufferMode mode);
+
 // OPTIONAL!  This isn't normally needed.  But, if you've enabled double
 // buffering, you MUST Present() whenever you would like to show the results
 // of all your drawing code since the last time you called Present().
@@ -270,6 +398,53 @@ void UseDoubleBuffering(bool enabled);
 void Present();
 
 
+// ADVANCED!  Each call to DrawPixel or ReadPixel has to wait its turn to
+// touch the screen, which adds up when you're working with thousands of
+// pixels at a time.  These do the same job for a whole batch of pixels
+// while only waiting once.  Anything that lands off the screen is skipped.
+
+// One entry in the list of pixels passed to DrawPixels.
+struct PixelPoint { int x; int y; Color c; };
+
+// Draws "count" pixels from the list, just as if DrawPixel was called for each.
+void DrawPixels(const PixelPoint *pixels, int count);
+
+// Draws "length" pixels in a row, starting at (x, y) and going to the right.
+void DrawHorizontalSpan(int x, int y, int length, Color c);
+
+// Draws "count" colors onto the screen in a row, starting at (x, y) and going
+// to the right.  colors[0] lands on (x, y), colors[1] lands on (x + 1, y), etc.
+void DrawHorizontalSpan(int x, int y, const Color *colors, int count);
+
+// Reads a width x height rectangle of the screen (with its top-left corner at
+// (x, y)) into "destination", one row after another.  destination must have
+// room for width*height colors.  Pixels off the screen are read as Black.
+void ReadPixels(int x, int y, int width, int height, Color *destination);
+
+
+// ADVANCED!  Normally, each drawing function does its work right away.  With
+// deferred drawing turned on, the drawing functions only make a note of what
+// you asked for, and all of that work is done at once the next time you call
+// Present().  Doing everything in one batch lets Immediate2D skip drawing that
+// would be covered up anyway and merge neighboring pixels and rectangles.
+//
+// ReadPixel (and ReadPixels) only see what has already been drawn, so they
+// won't include anything that is still waiting for the next Present().
+//
+// This also helps a lot if you draw from more than one thread at the same time
+// (like example9_raytracer does): each thread gets its own list, so they don't
+// have to keep waiting for each other.  Each thread's drawing happens in the
+// order it was asked for, but there's no telling which thread's drawing will
+// end up on top if two of them draw in the same spot.
+//
+void UseDeferredDrawing(bool enabled);
+
+// While deferred drawing is on, this is how many drawing commands have been
+// recorded since the last Present().  Check it just before calling Present()
+// to find out how many commands each frame used.
+int DeferredCommandCount();
+
+
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -291,6 +466,9 @@ void CloseWindow();
 // Calling SaveImage() will give you a file called "image.png".  If you include
 // a number like SaveImage(26) then you'll get a file called "image_26.png".
 //
+// With IMM2D_HEADLESS (where there is no desktop) the file goes in the current
+// working directory instead.
+//
 void SaveImage(unsigned int suffix = 0);
 
 
@@ -489,15 +667,36 @@ extern const int PixelScale;
 #ifdef IMM2D_IMPLEMENTATION
 
 #include <map>
+#include <tuple>
+#include <unordered_map>
 #include <mutex>
+#include <condition_variable>
 #include <deque>
+#include <list>
+#include <cmath>
+#include <ctime>
+#include <chrono>
+#include <thread>
 #include <vector>
 #include <string>
 #include <atomic>
 #include <memory>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
 #include <numeric>
+#include <stdexcept>
 #include <algorithm>
 
+// A few bulk pixel operations use SIMD instructions when the compiler is targeting them
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMM2D_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define IMM2D_NEON
+#include <arm_neon.h>
+#endif
+
 #ifndef IMM2D_WIDTH
 #define IMM2D_WIDTH 160
 #endif
@@ -518,6 +717,8 @@ const int Width = IMM2D_WIDTH;
 const int Height = IMM2D_HEIGHT;
 const int PixelScale = IMM2D_SCALE;
 
+#ifndef IMM2D_HEADLESS
+
 // The standard library's min/max algorithms conflict with Microsoft's
 // min/max macros, but if you define NOMINMAX, the Windows header omits them.
 #define NOMINMAX
@@ -546,6 +747,8 @@ namespace Gdiplus { using std::min; using std::max; }
 #pragma comment(lib, "Shell32.lib")
 #pragma comment(lib, "Shlwapi.lib")
 
+#endif
+
 // The primary user-supplied function that we call on its own thread
 extern void run();
 
@@ -555,29 +758,222 @@ extern void run();
 // Immediate2D internal state
 //
 
-static bool imm2d_dirty{ true };
 static bool imm2d_doubleBuffered{ false };
+static bool imm2d_discardBackBuffer{ false };
+static bool imm2d_antiAliased{ false };
+static CacheStats imm2d_textCacheStats{};
 
 static std::atomic<char> imm2d_key{ 0 };
 static std::atomic<bool> imm2d_quitting{ false };
 static std::atomic<bool> imm2d_musicRunning{ true };
 static std::atomic<bool> imm2d_mouseDown[3]{ false, false, false };
 static std::atomic<int> imm2d_mouseX{ -1 }, imm2d_mouseY{ -1 };
-static std::atomic<ULONGLONG> imm2d_runDuration{ 0 };
+
+// Used to time animated images
+static const std::chrono::steady_clock::time_point imm2d_startTime = std::chrono::steady_clock::now();
+static uint64_t imm2d_RunDuration()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - imm2d_startTime).count();
+}
 
 static std::mutex imm2d_bitmapLock;
+
+// The drawing surfaces are plain Width*Height blocks of ARGB pixels (in the same layout
+// Present(screen) uses) that we own.  On Windows, each is wrapped by a GDI+ Bitmap that
+// points at that same memory, so GDI+ can draw right into it while single pixels can be
+// read and written directly instead of with a LockBits/UnlockBits round trip each time.
+static std::vector<uint32_t> imm2d_pixels, imm2d_pixelsOther;
+
+// A short list of the parts of a drawing surface that have changed, so the window only
+// has to repaint those.  Rectangles that overlap or touch are merged, and once the list
+// is full, each new one is merged into whichever existing one grows the least.
+struct Imm2dDirtyRegion
+{
+    struct Rect { int left, top, right, bottom; };
+
+    static constexpr int MaxRects = 16;
+    Rect rects[MaxRects];
+    int count = 0;
+
+    void add(Rect r)
+    {
+        r = { std::max(r.left, 0), std::max(r.top, 0), std::min(r.right, Width), std::min(r.bottom, Height) };
+        if (r.left >= r.right || r.top >= r.bottom) return;
+
+        const auto area = [](const Rect &a) { return int64_t(a.right - a.left) * (a.bottom - a.top); };
+        const auto merge = [](const Rect &a, const Rect &b) {
+            return Rect{ std::min(a.left, b.left), std::min(a.top, b.top), std::max(a.right, b.right), std::max(a.bottom, b.bottom) };
+        };
+
+        for (int i = 0; i < count; )
+        {
+            const Rect &existing = rects[i];
+            if (r.left > existing.right || existing.left > r.right || r.top > existing.bottom || existing.top > r.bottom) { ++i; continue; }
+
+            // Merging can make the new rectangle touch ones we've already passed, so start over
+            r = merge(r, existing);
+            rects[i] = rects[--count];
+            i = 0;
+        }
+
+        if (count == MaxRects)
+        {
+            int best = 0;
+            int64_t bestGrowth = INT64_MAX;
+            for (int i = 0; i < count; ++i)
+            {
+                const int64_t growth = area(merge(rects[i], r)) - area(rects[i]);
+                if (growth < bestGrowth) { best = i; bestGrowth = growth; }
+            }
+
+            r = merge(r, rects[best]);
+            rects[best] = rects[--count];
+            return add(r);
+        }
+
+        rects[count++] = r;
+    }
+
+    void add(const Imm2dDirtyRegion &other) { for (int i = 0; i < other.count; ++i) add(other.rects[i]); }
+    void addAll() { rects[0] = { 0, 0, Width, Height }; count = 1; }
+    void clear() { count = 0; }
+};
+
+// What the window needs to repaint, and what has changed on the hidden back-buffer since
+// the last Present (which only matters when double buffering)
+static Imm2dDirtyRegion imm2d_frontDirty, imm2d_backDirty;
+
+// Single pixels come in far too many (and far too small) to be worth merging into a region
+// one at a time, so DrawPixel just grows this box instead.  It's folded into whichever region
+// is current by imm2d_FlushPixelBox before anything reads (or switches) the regions.
+struct Imm2dDirtyBox
+{
+    int left = Width, top = Height, right = 0, bottom = 0;
+
+    void add(int l, int t, int r, int b)
+    {
+        left = std::min(left, l);
+        top = std::min(top, t);
+        right = std::max(right, r);
+        bottom = std::max(bottom, b);
+    }
+
+    void add(int x, int y) { add(x, y, x + 1, y + 1); }
+    bool empty() const { return left >= right || top >= bottom; }
+    void clear() { *this = Imm2dDirtyBox(); }
+};
+
+static Imm2dDirtyBox imm2d_pixelBox;
+
+// Decides when the window should repaint, given whether anything has changed and when the
+// last repaint happened.  It doesn't know anything about windows or threads (the current
+// time is always passed in), so it can be tested on its own.  Used while bitmapLock is held.
+struct Imm2dRepaintSchedule
+{
+    using Clock = std::chrono::steady_clock;
+
+    // Repainting more often than this would just fight the drawing thread for bitmapLock
+    static constexpr std::chrono::milliseconds MinInterval{ 5 };
+
+    bool pending = false;
+    Clock::time_point lastRepaint{};
+
+    // Returns true when the UI thread needs to be woken up.  (If a repaint was already
+    // pending, it's either awake already or will wake up on its own when it's time.)
+    bool changed()
+    {
+        if (pending) return false;
+        pending = true;
+        return true;
+    }
+
+    // How long the UI thread can sleep before it should repaint (or duration::max() if
+    // there's nothing to repaint at all).  Zero means right now.
+    Clock::duration untilRepaint(Clock::time_point now) const
+    {
+        if (!pending) return Clock::duration::max();
+
+        const auto due = lastRepaint + MinInterval;
+        return due > now ? due - now : Clock::duration::zero();
+    }
+
+    void repainted(Clock::time_point now)
+    {
+        pending = false;
+        lastRepaint = now;
+    }
+};
+
+static Imm2dRepaintSchedule imm2d_repaint;
+
+// The UI thread sleeps until one of these is signaled (or a window message shows up)
+#ifndef IMM2D_HEADLESS
+static HANDLE imm2d_wakeEvent{};
+#else
+static std::mutex imm2d_wakeLock;
+static std::condition_variable imm2d_wake;
+#endif
+
+static void imm2d_WakeUIThread()
+{
+#ifndef IMM2D_HEADLESS
+    if (imm2d_wakeEvent) SetEvent(imm2d_wakeEvent);
+#else
+    // Taking the lock (even briefly) means the main thread can't miss this between checking
+    // imm2d_quitting and going to sleep
+    { std::lock_guard<std::mutex> lock(imm2d_wakeLock); }
+    imm2d_wake.notify_all();
+#endif
+}
+
+// Must be called (while bitmapLock is held) after anything is added to imm2d_frontDirty
+static void imm2d_FrontChanged()
+{
+    if (imm2d_repaint.changed()) imm2d_WakeUIThread();
+}
+
+#ifndef IMM2D_HEADLESS
 static std::unique_ptr<Gdiplus::Bitmap> imm2d_bitmap, imm2d_bitmapOther;
 static std::unique_ptr<Gdiplus::Graphics> imm2d_graphics, imm2d_graphicsOther;
 static std::map<std::pair<std::string, int>, std::unique_ptr<Gdiplus::Font>> imm2d_fonts;
+#endif
 
 static std::mutex imm2d_mediaLock;
-static std::vector<std::unique_ptr<Gdiplus::Bitmap>> imm2d_images;
+
+// Each loaded image is all of its pixels in a row (followed by any other animation frames),
+// decoded once by LoadImage so DrawImage only has to copy them
+static std::vector<std::vector<uint32_t>> imm2d_images;
 static std::vector<std::pair<int, int>> imm2d_imageSizes;
-static std::vector<uint32_t> imm2d_imageFrameCount;
-static std::vector<size_t> imm2d_imageFrameStart;
-static std::vector<uint32_t> imm2d_imageFrameCumulativeCentiSeconds;
+static std::vector<std::vector<uint32_t>> imm2d_imageFrameCumulativeCentiSeconds;
 static std::vector<uint32_t> imm2d_imageFrameSumMs;
 
+// Images from LoadImageAsync get their handle before their pixels, and images let go to stay
+// under the memory budget keep their handle (and name, so they can be loaded again) without
+// them.  (Reloading is an Evicted image that's back in line for a loader thread.)  Anyone
+// waiting on a Loading or Reloading image is woken by imm2d_imageLoaded.
+enum class Imm2dImageState : uint8_t { Loading, Loaded, Evicted, Reloading, Unloaded };
+static std::vector<Imm2dImageState> imm2d_imageStates;
+static std::vector<std::string> imm2d_imageNames;
+static std::condition_variable imm2d_imageLoaded;
+
+// Handles given back by UnloadImage (or by a load that failed), for LoadImage to use again.
+// Each handle's generation goes up when it's given back, so anyone still waiting on the old
+// image can tell it isn't theirs anymore.
+static std::vector<Image> imm2d_freeImages;
+static std::vector<uint32_t> imm2d_imageGenerations;
+
+// Every draw call ticks the clock and stamps the images it uses, so the memory budget knows
+// which ones have gone the longest without being drawn
+static std::vector<uint64_t> imm2d_imageLastDrawn;
+static uint64_t imm2d_imageClock = 0;
+static long long imm2d_imageMemoryUsed = 0;
+static long long imm2d_imageMemoryBudget = 0;
+
+// Every name LoadImage has succeeded with (hashed, so huge Base64 strings are quick to look up).
+// Two names could have the same hash, so each match is checked against imm2d_imageNames.
+static std::unordered_multimap<uint64_t, Image> imm2d_imagesByName;
+static CacheStats imm2d_imageCacheStats{};
+
 static std::mutex imm2d_musicLock;
 
 struct Imm2dMusicNote { uint8_t noteId; uint32_t duration; };
@@ -586,33 +982,75 @@ static std::deque<Imm2dMusicNote> imm2d_musicQueue;
 static std::mutex imm2d_inputLock;
 static std::deque<char> imm2d_inputBuffer;
 
-void Present()
+#ifndef IMM2D_HEADLESS
+void Wait(int milliseconds) { ::Sleep(milliseconds); }
+#else
+void Wait(int milliseconds) { std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds)); }
+#endif
+
+void CloseWindow()
 {
-    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+    imm2d_quitting = true;
+    imm2d_WakeUIThread();
+}
 
-    if (imm2d_doubleBuffered)
+char LastKey() { return imm2d_key.exchange(0); }
+
+// Marks part of the drawing surface as changed.  right and bottom are just past the edge of
+// the changed part.  Must be called while bitmapLock is held.
+static void imm2d_SetDirty(int left, int top, int right, int bottom)
+{
+    if (imm2d_bitmapLock.try_lock()) throw std::runtime_error("SetDirty must be called while bitmapLock is held.");
+
+    // Until the next Present, changes to the back-buffer don't affect what's in the window
+    if (imm2d_doubleBuffered) imm2d_backDirty.add(Imm2dDirtyRegion::Rect{ left, top, right, bottom });
+    else
     {
-        // This is more "offscreen composition" than double-buffering.  We could probably add a
-        // an option to avoid this copy if the user really knew that they were going to redraw the
-        // entire screen each frame.  But for now we assume immediate-mode drawing and make sure
-        // things are consistent instead of flickering each frame if you've got different sets of
-        // things drawn on each buffer
-        imm2d_graphicsOther->DrawImage(imm2d_bitmap.get(), 0, 0);
+        imm2d_frontDirty.add(Imm2dDirtyRegion::Rect{ left, top, right, bottom });
+        imm2d_FrontChanged();
     }
+}
 
-    std::swap(imm2d_graphics, imm2d_graphicsOther);
-    std::swap(imm2d_bitmap, imm2d_bitmapOther);
-    imm2d_dirty = true;
+// The same, for shapes with fractional (and possibly anti-aliased) edges.  The extra
+// pixel of padding on each side covers any rounding and anti-aliasing differences.
+static void imm2d_SetDirty(float left, float top, float right, float bottom)
+{
+    const auto toPixel = [](float v, int limit) { return int(std::max(-2.0f, std::min(float(limit) + 2, v))); };
+    imm2d_SetDirty(toPixel(std::floor(left), Width) - 1, toPixel(std::floor(top), Height) - 1, toPixel(std::ceil(right), Width) + 2, toPixel(std::ceil(bottom), Height) + 2);
+}
+
+// Must be called while bitmapLock is held, before anything reads imm2d_frontDirty or
+// imm2d_backDirty, or changes which one is current
+static void imm2d_FlushPixelBox()
+{
+    if (imm2d_pixelBox.empty()) return;
+
+    imm2d_SetDirty(imm2d_pixelBox.left, imm2d_pixelBox.top, imm2d_pixelBox.right, imm2d_pixelBox.bottom);
+    imm2d_pixelBox.clear();
+}
+
+// The cheap version of imm2d_SetDirty for DrawPixel and friends.  (Waking the UI thread only
+// costs anything the first time after each repaint.)
+static void imm2d_SetPixelsDirty(int left, int top, int right, int bottom)
+{
+    imm2d_pixelBox.add(left, top, right, bottom);
+    if (!imm2d_doubleBuffered) imm2d_FrontChanged();
 }
 
-void CloseWindow() { imm2d_quitting = true; }
-char LastKey() { return imm2d_key.exchange(0); }
-void Wait(int milliseconds) { ::Sleep(milliseconds); }
 void UseDoubleBuffering(bool enabled)
+{
+    UseDoubleBuffering(enabled ? DoubleBufferMode::Preserve : DoubleBufferMode::Off);
+}
+
+void UseDoubleBuffering(DoubleBufferMode mode)
 {
     std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
-    imm2d_doubleBuffered = enabled;
-    imm2d_dirty = true;
+    imm2d_FlushPixelBox();
+    imm2d_doubleBuffered = mode != DoubleBufferMode::Off;
+    imm2d_discardBackBuffer = mode == DoubleBufferMode::Discard;
+    imm2d_frontDirty.addAll();
+    imm2d_FrontChanged();
+    imm2d_backDirty.clear();
 }
 
 int MouseX() { return imm2d_mouseX; }
@@ -621,12 +1059,7 @@ bool LeftMousePressed() { return imm2d_mouseDown[0]; }
 bool RightMousePressed() { return imm2d_mouseDown[1]; }
 bool MiddleMousePressed() { return imm2d_mouseDown[2]; }
 
-static void imm2d_SetDirty()
-{
-    if (imm2d_bitmapLock.try_lock()) throw std::runtime_error("SetDirty must be called while bitmapLock is held.");
-    if (!imm2d_doubleBuffered) imm2d_dirty = true;
-}
-
+#ifndef IMM2D_HEADLESS
 static const std::wstring imm2d_ToWide(const char *utf8)
 {
     const int wlen = ::MultiByteToWideChar(CP_UTF8, 0, utf8, -1, nullptr, 0);
@@ -636,6 +1069,27 @@ static const std::wstring imm2d_ToWide(const char *utf8)
     return success ? std::wstring(buffer.get()) : std::wstring();
 }
 
+// Reads one character from UTF-8 text, moving p past it.  Anything malformed comes
+// out as U+FFFD (the "replacement character").
+static uint32_t imm2d_NextCodepoint(const char *&p, const char *end)
+{
+    const uint8_t lead = uint8_t(*p++);
+    if (lead < 0x80) return lead;
+
+    const int extra = lead >= 0xF8 ? -1 : lead >= 0xF0 ? 3 : lead >= 0xE0 ? 2 : lead >= 0xC0 ? 1 : -1;
+    if (extra < 0) return 0xFFFD;
+
+    uint32_t codepoint = lead & (0x3F >> extra);
+    for (int i = 0; i < extra; ++i)
+    {
+        if (p == end || (uint8_t(*p) & 0xC0) != 0x80) return 0xFFFD;
+        codepoint = (codepoint << 6) | (uint8_t(*p++) & 0x3F);
+    }
+
+    return codepoint;
+}
+#endif
+
 char LastBufferedKey()
 {
     std::lock_guard<std::mutex> lock(imm2d_inputLock);
@@ -652,6 +1106,7 @@ void ClearInputBuffer()
     imm2d_inputBuffer.clear();
 }
 
+#ifndef IMM2D_HEADLESS
 static void imm2d_AddBufferedKey(char c)
 {
     std::lock_guard<std::mutex> lock(imm2d_inputLock);
@@ -660,6 +1115,7 @@ static void imm2d_AddBufferedKey(char c)
     imm2d_inputBuffer.push_back(c);
     while (imm2d_inputBuffer.size() > 100) imm2d_inputBuffer.pop_front();
 }
+#endif
 
 // Nice, fast, reasonably high-quality public-domain PRNG from http://xoroshiro.di.unimi.it/xoroshiro128plus.c
 //
@@ -697,6 +1153,8 @@ double RandomDouble()
     return U{ UINT64_C(0x3FF) << 52 | imm2d_xoroshiro128plus() >> 12 }.d - 1.0;
 }
 
+#ifndef IMM2D_HEADLESS
+
 // GDI+ makes us work a little harder before we can save as a particular image type
 static CLSID imm2d_GetEncoderClsid(const std::wstring &format)
 {
@@ -741,6 +1199,8 @@ void SaveImage(unsigned int suffix)
     imm2d_bitmap->Save(path.c_str(), &png, NULL);
 }
 
+#endif
+
 
 
 
@@ -764,9 +1224,23 @@ void SaveImage(unsigned int suffix)
 // And once you've placed every color value:
 //    Present(screen);
 //
+// Unlike the drawing functions, this replaces the whole screen with exactly the
+// colors you pass in.  Nothing is blended, even if some of them are see-through.
+//
 void Present(const std::vector<Color> &screen);
 
-Color MakeColor(int r, int g, int b, int a)
+// The same as Present(screen), except instead of copying your colors, Immediate2D
+// trades screens with you: it keeps your vector to show, and gives you back the
+// one it was showing until now (which is the same size) to draw your next frame
+// into.  If you redraw the whole screen every frame anyway, this skips copying
+// Width*Height colors each time.
+//
+// Afterward, "screen" still holds a whole frame of colors, but they're whatever
+// was on the screen before this call, not what you just drew.
+//
+void PresentSwap(std::vector<Color> &screen);
+
+constexpr Color MakeColor(int r, int g, int b, int a)
 {
     return ((a & 0xFF) << 24) | ((r & 0xFF) << 16) | ((g & 0xFF) << 8) | ((b & 0xFF) << 0);
 }
@@ -811,400 +1285,3810 @@ Color MakeColorHSB(int hue, int sat, int val)
     return MakeColor(int(var_r * 255), int(var_g * 255), int(var_b * 255));
 }
 
-void imm2d_setAntiAliasing(bool enabled)
+static uint32_t *imm2d_PixelAt(int x, int y)
 {
-    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
-    if (!imm2d_graphics) return;
-
-    imm2d_graphics->SetSmoothingMode(enabled ? Gdiplus::SmoothingModeAntiAlias : Gdiplus::SmoothingModeNone);
-    imm2d_graphicsOther->SetSmoothingMode(enabled ? Gdiplus::SmoothingModeAntiAlias : Gdiplus::SmoothingModeNone);
+    if (x < 0 || x >= Width || y < 0 || y >= Height) return nullptr;
+    return &imm2d_pixels[size_t(y) * Width + x];
 }
 
-void UseAntiAliasing() { imm2d_setAntiAliasing(true); }
-void StopAntiAliasing() { imm2d_setAntiAliasing(false); }
-
-
-void DrawPixel(int x, int y, Color c)
+// Trims a span of pixels down to the part that is on the screen, returning
+// how far the start moved (or -1 if there's nothing left to draw).
+static int imm2d_ClipSpan(int &x, int y, int &length)
 {
-    if (x < 0 || x >= Width || y < 0 || y >= Height) return;
-
-    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
-    if (!imm2d_graphics) return;
+    if (y < 0 || y >= Height || length <= 0) return -1;
 
-    Gdiplus::BitmapData d;
+    const int skipped = x < 0 ? -x : 0;
+    x += skipped;
+    length = std::min(length - skipped, Width - x);
+    return length > 0 ? skipped : -1;
+}
 
-    Gdiplus::Rect r(x, y, 1, 1);
-    imm2d_bitmap->LockBits(&r, Gdiplus::ImageLockModeWrite, imm2d_bitmap->GetPixelFormat(), &d);
-    *reinterpret_cast<uint32_t *>(d.Scan0) = c;
-    imm2d_bitmap->UnlockBits(&d);
 
-    imm2d_SetDirty();
-}
+//
+// Software rasterizers
+//
+// These draw straight into our own pixel arrays.  The headless version uses them
+// for everything, and the Windows version uses them for everything except text
+// and images (which still come from GDI+).
+//
+// GDI+ fills shapes by sampling the center of each pixel but strokes outlines
+// along the pixel's top-left corner, so we do the same to produce the same results.
+//
 
-void Present(const std::vector<Color> &screen)
+// Composites c on top of the pixel d, the way GDI+ draws translucent colors
+static uint32_t imm2d_Blend(uint32_t d, Color c)
 {
-    if (screen.size() != Width * Height) return;
+    const uint32_t sa = c >> 24;
+    if (sa == 255) return c;
+    if (sa == 0) return d;
 
-    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
-    if (!imm2d_graphics) return;
+    // Blending onto something opaque (like almost everything on the screen) stays opaque, and
+    // the division below is always by 255, which can be done with a couple shifts instead
+    if ((d >> 24) == 255)
+    {
+        const auto divide255 = [](uint32_t v) { return (v + 1 + (v >> 8)) >> 8; };
 
-    Gdiplus::BitmapData d;
-    Gdiplus::Rect r(0, 0, Width, Height);
+        uint32_t result = 0xFF000000;
+        for (int shift = 0; shift < 24; shift += 8)
+        {
+            const uint32_t s = (c >> shift) & 0xFF;
+            const uint32_t t = (d >> shift) & 0xFF;
+            result |= divide255(s * sa + t * (255 - sa)) << shift;
+        }
+        return result;
+    }
 
-    auto &b = imm2d_doubleBuffered ? imm2d_bitmapOther : imm2d_bitmap;
-    b->LockBits(&r, Gdiplus::ImageLockModeWrite, b->GetPixelFormat(), &d);
+    const uint32_t da = (d >> 24) * (255 - sa) / 255;
+    const uint32_t a = sa + da;
 
-    auto dstLine = reinterpret_cast<uint32_t *>(d.Scan0);
-    for (int y = 0; y < Height; ++y)
+    uint32_t result = a << 24;
+    for (int shift = 0; shift < 24; shift += 8)
     {
-        auto srcLine = &screen[Width * y];
-        memcpy(dstLine, srcLine, Width * sizeof(uint32_t));
-        dstLine += d.Stride / 4;
+        const uint32_t s = (c >> shift) & 0xFF;
+        const uint32_t t = (d >> shift) & 0xFF;
+        result |= ((s * sa + t * da) / a) << shift;
     }
 
-    b->UnlockBits(&d);
-    imm2d_dirty = true;
-}
-
-Color ReadPixel(int x, int y)
-{
-    if (x < 0 || x >= Width || y < 0 || y >= Height) return Black;
-
-    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
-    if (!imm2d_graphics) return Black;
-
-    Gdiplus::Color c;
-    imm2d_bitmap->GetPixel(x, y, &c);
-    return c.GetValue();
+    return result;
 }
 
-void DrawLine(int x1, int y1, int x2, int y2, int thickness, Color c)
+static void imm2d_BlendPixel(int x, int y, Color c)
 {
-    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
-    if (!imm2d_graphics) return;
-
-    Gdiplus::Color color(c);
-    Gdiplus::Pen p(c, (float)thickness);
-    p.SetStartCap(Gdiplus::LineCapRound);
-    p.SetEndCap(Gdiplus::LineCapRound);
-
-    imm2d_graphics->DrawLine(&p, x1, y1, x2, y2);
-
-    imm2d_SetDirty();
+    uint32_t *p = imm2d_PixelAt(x, y);
+    if (p) *p = imm2d_Blend(*p, c);
 }
 
-void DrawLine(float x1, float y1, float x2, float y2, int thickness, Color c)
+// Stores c into "count" pixels in a row, using the widest aligned stores we have
+static void imm2d_FillPixels(uint32_t *p, size_t count, Color c)
 {
-    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
-    if (!imm2d_graphics) return;
+#if defined(IMM2D_SSE2)
+    while (count > 0 && (reinterpret_cast<uintptr_t>(p) & 15)) { *p++ = c; --count; }
 
-    Gdiplus::Color color(c);
-    Gdiplus::Pen p(c, (float)thickness);
-    p.SetStartCap(Gdiplus::LineCapRound);
-    p.SetEndCap(Gdiplus::LineCapRound);
-
-    imm2d_graphics->DrawLine(&p, x1, y1, x2, y2);
-
-    imm2d_SetDirty();
-}
-
-void DrawCircle(int x, int y, int radius, Color fill, Color stroke)
-{
-    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
-    if (!imm2d_graphics) return;
+    const __m128i v = _mm_set1_epi32(static_cast<int>(c));
+    __m128i *out = reinterpret_cast<__m128i *>(p);
 
-    Gdiplus::Rect r(x - radius, y - radius, radius * 2, radius * 2);
+    // Something as big as a whole HD screen won't fit in the cache anyway, so it's faster
+    // to write straight to memory instead of reading each line into the cache first
+    if (count >= (size_t(1) << 18))
+    {
+        for (; count >= 16; count -= 16, out += 4)
+        {
+            _mm_stream_si128(out, v);
+            _mm_stream_si128(out + 1, v);
+            _mm_stream_si128(out + 2, v);
+            _mm_stream_si128(out + 3, v);
+        }
+        _mm_sfence();
+    }
 
-    if (fill != Transparent)
+    for (; count >= 16; count -= 16, out += 4)
     {
-        Gdiplus::SolidBrush brush{ Gdiplus::Color(fill) };
-        imm2d_graphics->FillEllipse(&brush, r);
+        _mm_store_si128(out, v);
+        _mm_store_si128(out + 1, v);
+        _mm_store_si128(out + 2, v);
+        _mm_store_si128(out + 3, v);
     }
+    for (; count >= 4; count -= 4) _mm_store_si128(out++, v);
 
-    if (stroke != Transparent)
+    p = reinterpret_cast<uint32_t *>(out);
+#elif defined(IMM2D_NEON)
+    const uint32x4_t v = vdupq_n_u32(c);
+    for (; count >= 16; count -= 16, p += 16)
     {
-        Gdiplus::Pen pen{ Gdiplus::Color(stroke) };
-        imm2d_graphics->DrawEllipse(&pen, r);
+        vst1q_u32(p, v);
+        vst1q_u32(p + 4, v);
+        vst1q_u32(p + 8, v);
+        vst1q_u32(p + 12, v);
     }
+    for (; count >= 4; count -= 4, p += 4) vst1q_u32(p, v);
+#endif
 
-    imm2d_SetDirty();
+    while (count-- > 0) *p++ = c;
 }
 
-void DrawCircle(float x, float y, float radius, Color fill, Color stroke)
+// Blends c onto "count" pixels in a row.  Solid colors are just stored.  Everything else is
+// done in the "premultiplied" form of source-over: c's channels are multiplied by its alpha
+// once, up front, so each pixel only needs one multiply and add per channel (for a whole
+// vector of pixels at a time).  The results are exactly the same as imm2d_Blend's.
+static void imm2d_BlendPixels(uint32_t *p, size_t count, Color c)
 {
-    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
-    if (!imm2d_graphics) return;
+    const uint32_t sa = c >> 24;
+    if (sa == 255) { imm2d_FillPixels(p, count, c); return; }
+    if (sa == 0) return;
 
-    Gdiplus::RectF r(x - radius, y - radius, radius * 2, radius * 2);
+    size_t i = 0;
 
-    if (fill != Transparent)
+#if defined(IMM2D_SSE2)
+    const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi16(1), opaque = _mm_set1_epi32(int(0xFF000000));
+    const __m128i source = _mm_mullo_epi16(_mm_unpacklo_epi8(_mm_set1_epi32(int(c)), zero), _mm_set1_epi16(short(sa)));
+    const __m128i inverse = _mm_set1_epi16(short(255 - sa));
+    const auto divide255 = [&](__m128i v) { return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(v, one), _mm_srli_epi16(v, 8)), 8); };
+
+    for (; i + 4 <= count; i += 4)
     {
-        Gdiplus::SolidBrush brush{ Gdiplus::Color(fill) };
-        imm2d_graphics->FillEllipse(&brush, r);
+        __m128i *out = reinterpret_cast<__m128i *>(p + i);
+        const __m128i d = _mm_loadu_si128(out);
+
+        // The shortcut only works on top of solid pixels (which is nearly always)
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(d, opaque), opaque)) != 0xFFFF)
+        {
+            for (size_t k = i; k < i + 4; ++k) p[k] = imm2d_Blend(p[k], c);
+            continue;
+        }
+
+        const __m128i lo = divide255(_mm_add_epi16(source, _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), inverse)));
+        const __m128i hi = divide255(_mm_add_epi16(source, _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), inverse)));
+        _mm_storeu_si128(out, _mm_or_si128(_mm_packus_epi16(lo, hi), opaque));
     }
+#elif defined(IMM2D_NEON)
+    // Loading four interleaved planes splits eight pixels into blue, green, red, and alpha
+    const uint8x8_t inverse = vdup_n_u8(uint8_t(255 - sa));
+    const uint16x8_t one = vdupq_n_u16(1);
+    const uint16x8_t source[3] = { vdupq_n_u16(uint16_t((c & 0xFF) * sa)), vdupq_n_u16(uint16_t(((c >> 8) & 0xFF) * sa)), vdupq_n_u16(uint16_t(((c >> 16) & 0xFF) * sa)) };
 
-    if (stroke != Transparent)
+    for (; i + 8 <= count; i += 8)
     {
-        Gdiplus::Pen pen{ Gdiplus::Color(stroke) };
-        imm2d_graphics->DrawEllipse(&pen, r);
+        uint8_t *out = reinterpret_cast<uint8_t *>(p + i);
+        uint8x8x4_t d = vld4_u8(out);
+
+        if (vget_lane_u64(vreinterpret_u64_u8(vmvn_u8(d.val[3])), 0) != 0)
+        {
+            for (size_t k = i; k < i + 8; ++k) p[k] = imm2d_Blend(p[k], c);
+            continue;
+        }
+
+        for (int channel = 0; channel < 3; ++channel)
+        {
+            const uint16x8_t v = vmlal_u8(source[channel], d.val[channel], inverse);
+            d.val[channel] = vshrn_n_u16(vaddq_u16(vaddq_u16(v, one), vshrq_n_u16(v, 8)), 8);
+        }
+        vst4_u8(out, d);
     }
+#endif
 
-    imm2d_SetDirty();
+    for (; i < count; ++i) p[i] = imm2d_Blend(p[i], c);
 }
 
-void DrawArc(int x, int y, float radius, float thickness, Color c, float startRadians, float endRadians)
+// Blends each of "colors" onto the matching pixel in a row, the same way
+static void imm2d_BlendPixels(uint32_t *p, const Color *colors, size_t count)
 {
-    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
-    if (!imm2d_graphics) return;
+    size_t i = 0;
 
-    Gdiplus::Color color(c);
-    Gdiplus::Pen p(c, thickness);
-    p.SetStartCap(Gdiplus::LineCapRound);
-    p.SetEndCap(Gdiplus::LineCapRound);
+#if defined(IMM2D_SSE2)
+    const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi16(1), full = _mm_set1_epi16(255), opaque = _mm_set1_epi32(int(0xFF000000));
+    const auto divide255 = [&](__m128i v) { return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(v, one), _mm_srli_epi16(v, 8)), 8); };
 
-    const auto s = static_cast<Gdiplus::REAL>(startRadians * 360.0 / Tau);
-    const auto e = static_cast<Gdiplus::REAL>(endRadians * 360.0 / Tau);
-    imm2d_graphics->DrawArc(&p, x - radius, y - radius, radius * 2, radius * 2, s, e - s);
-    imm2d_SetDirty();
-}
+    // Each color's alpha, copied into all four of its channels
+    const auto spreadAlpha = [](__m128i v) { return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3)); };
 
-void DrawRectangle(int x, int y, int width, int height, Color fill, Color stroke)
-{
-    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
-    if (!imm2d_graphics) return;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i *out = reinterpret_cast<__m128i *>(p + i);
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(colors + i));
+        const __m128i sourceAlpha = _mm_and_si128(s, opaque);
 
-    // GDI+'s DrawRectangle and FillRectangle behave a little differently: One
-    // of them treats the end coordinates as inclusive and the other exclusive
-    const int adjustment = fill != Transparent ? 0 : -1;
+        // Whole groups of solid (or invisible) colors are common in images
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(sourceAlpha, opaque)) == 0xFFFF) { _mm_storeu_si128(out, s); continue; }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(sourceAlpha, zero)) == 0xFFFF) continue;
 
-    Gdiplus::Rect r(x, y, width + adjustment, height + adjustment);
+        const __m128i d = _mm_loadu_si128(out);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(d, opaque), opaque)) != 0xFFFF)
+        {
+            for (size_t k = i; k < i + 4; ++k) p[k] = imm2d_Blend(p[k], colors[k]);
+            continue;
+        }
 
-    if (fill != Transparent)
-    {
-        Gdiplus::SolidBrush brush{ Gdiplus::Color(fill) };
-        imm2d_graphics->FillRectangle(&brush, r);
+        const __m128i sLo = _mm_unpacklo_epi8(s, zero), sHi = _mm_unpackhi_epi8(s, zero);
+        const __m128i aLo = spreadAlpha(sLo), aHi = spreadAlpha(sHi);
+
+        const __m128i lo = divide255(_mm_add_epi16(_mm_mullo_epi16(sLo, aLo), _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(full, aLo))));
+        const __m128i hi = divide255(_mm_add_epi16(_mm_mullo_epi16(sHi, aHi), _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(full, aHi))));
+        _mm_storeu_si128(out, _mm_or_si128(_mm_packus_epi16(lo, hi), opaque));
     }
+#elif defined(IMM2D_NEON)
+    const uint16x8_t one = vdupq_n_u16(1);
 
-    if (stroke != Transparent)
+    for (; i + 8 <= count; i += 8)
     {
-        Gdiplus::Pen pen{ Gdiplus::Color(stroke) };
-        imm2d_graphics->DrawRectangle(&pen, r);
+        uint8_t *out = reinterpret_cast<uint8_t *>(p + i);
+        const uint8x8x4_t s = vld4_u8(reinterpret_cast<const uint8_t *>(colors + i));
+        uint8x8x4_t d = vld4_u8(out);
+
+        if (vget_lane_u64(vreinterpret_u64_u8(vmvn_u8(d.val[3])), 0) != 0)
+        {
+            for (size_t k = i; k < i + 8; ++k) p[k] = imm2d_Blend(p[k], colors[k]);
+            continue;
+        }
+
+        const uint8x8_t alpha = s.val[3], inverse = vmvn_u8(alpha);
+        for (int channel = 0; channel < 3; ++channel)
+        {
+            const uint16x8_t v = vmlal_u8(vmull_u8(s.val[channel], alpha), d.val[channel], inverse);
+            d.val[channel] = vshrn_n_u16(vaddq_u16(vaddq_u16(v, one), vshrq_n_u16(v, 8)), 8);
+        }
+        vst4_u8(out, d);
     }
+#endif
 
-    imm2d_SetDirty();
+    for (; i < count; ++i) p[i] = imm2d_Blend(p[i], colors[i]);
 }
 
-void DrawString(int x, int y, const char *text, const char *fontName, int fontPtSize, const Color c, bool centered)
+// Like DrawPixel, spans are blended onto what was already on the screen
+static void imm2d_DrawSpan(int x, int y, int length, Color c)
 {
-    if (!text || !fontName) return;
-    if (fontPtSize < 1 || !text[0]) return;
+    if (imm2d_ClipSpan(x, y, length) < 0) return;
+    imm2d_BlendPixels(imm2d_PixelAt(x, y), size_t(length), c);
+    imm2d_SetDirty(x, y, x + length, y + 1);
+}
+
+static void imm2d_DrawColors(int x, int y, const Color *colors, int count)
+{
+    const int skipped = imm2d_ClipSpan(x, y, count);
+    if (skipped < 0) return;
+    imm2d_BlendPixels(imm2d_PixelAt(x, y), colors + skipped, size_t(count));
+    imm2d_SetDirty(x, y, x + count, y + 1);
+}
+
+// Blends c onto a row of pixels, with its alpha scaled by the matching "mask" value (from
+// 0, which leaves the pixel alone, to 255 for all of c).  This is how anti-aliased shapes
+// and text are drawn.
+static void imm2d_BlendMask(uint32_t *p, const uint8_t *mask, size_t count, Color c)
+{
+    const uint32_t ca = c >> 24;
+    const Color rgb = c & 0xFFFFFF;
+    if (ca == 0) return;
+
+    Color colors[64];
+
+    for (size_t x = 0; x < count; )
+    {
+        // Runs of empty mask (like the middle of a ring) are skipped four at a time
+        uint32_t four = 1;
+        if (x + 4 <= count) std::memcpy(&four, mask + x, 4);
+        if (four == 0) { x += 4; continue; }
+        if (mask[x] == 0) { ++x; continue; }
+
+        // Runs of solid color can just be stored
+        if (mask[x] == 255 && ca == 255)
+        {
+            size_t end = x + 1;
+            while (end < count && mask[end] == 255) ++end;
+            imm2d_FillPixels(p + x, end - x, c);
+            x = end;
+            continue;
+        }
+
+        // Everything else (up to the next gap or solid run) is blended as a group
+        size_t n = 0;
+        for (; n < 64 && x + n < count; ++n)
+        {
+            const uint32_t m = mask[x + n];
+            if (m == 0 || (m == 255 && ca == 255)) break;
+            colors[n] = rgb | (((m * ca + 127) / 255) << 24);
+        }
+
+        imm2d_BlendPixels(p + x, colors, n);
+        x += n;
+    }
+}
+
+// Blends c onto every pixel from x1 to x2 (inclusive)
+static void imm2d_FillSpan(int x1, int x2, int y, Color c)
+{
+    if (y < 0 || y >= Height) return;
+
+    x1 = std::max(x1, 0);
+    x2 = std::min(x2, Width - 1);
+    if (x1 > x2) return;
+
+    imm2d_BlendPixels(imm2d_PixelAt(x1, y), size_t(x2 - x1) + 1, c);
+}
+
+// Blends c onto every pixel from (left, top) up to (but not including) (right, bottom)
+static void imm2d_FillRect(int left, int top, int right, int bottom, Color c)
+{
+    top = std::max(top, 0);
+    bottom = std::min(bottom, Height);
+    for (int y = top; y < bottom; ++y) imm2d_FillSpan(left, right - 1, y, c);
+}
+
+// Bresenham's line algorithm, written so it can start at any step along the line: the
+// minor axis after i steps is just (2*i*minorLength + majorLength) / (2*majorLength),
+// which lets us skip straight past any part of the line that's off the screen.
+static void imm2d_ThinLine(float fx1, float fy1, float fx2, float fy2, Color c)
+{
+    // Strokes go through pixel corners, so the nearest whole coordinate is the pixel
+    const int x1 = int(std::floor(fx1 + 0.5f)), y1 = int(std::floor(fy1 + 0.5f));
+    const int x2 = int(std::floor(fx2 + 0.5f)), y2 = int(std::floor(fy2 + 0.5f));
+
+    const bool steep = std::abs(y2 - y1) > std::abs(x2 - x1);
+    const int major1 = steep ? y1 : x1, minor1 = steep ? x1 : y1;
+    const int major2 = steep ? y2 : x2, minor2 = steep ? x2 : y2;
+    const int majorLimit = steep ? Height : Width, minorLimit = steep ? Width : Height;
+
+    const int majorStep = major2 >= major1 ? 1 : -1, minorStep = minor2 >= minor1 ? 1 : -1;
+    const int64_t majorLength = std::abs(int64_t(major2) - major1), minorLength = std::abs(int64_t(minor2) - minor1);
+
+    // The range of steps where the major axis is on the screen...
+    int64_t first = majorStep > 0 ? -int64_t(major1) : int64_t(major1) - (majorLimit - 1);
+    int64_t last = majorStep > 0 ? int64_t(majorLimit - 1) - major1 : int64_t(major1);
+    first = std::max<int64_t>(first, 0);
+    last = std::min(last, majorLength);
+
+    // ...narrowed to where the minor axis is, too (give or take a step, which the bounds
+    // check while drawing takes care of)
+    if (minorLength > 0)
+    {
+        const int64_t enter = minorStep > 0 ? -int64_t(minor1) : int64_t(minor1) - (minorLimit - 1);
+        const int64_t leave = minorStep > 0 ? int64_t(minorLimit - 1) - minor1 : int64_t(minor1);
+        if (leave < 0 || enter > minorLength) return;
+
+        first = std::max(first, (2 * enter - 1) * majorLength / (2 * minorLength) - 1);
+        last = std::min(last, (2 * leave + 1) * majorLength / (2 * minorLength) + 1);
+    }
+    else if (minor1 < 0 || minor1 >= minorLimit) return;
+
+    if (majorLength == 0)
+    {
+        imm2d_BlendPixel(x1, y1, c);
+        return;
+    }
+
+    int64_t numerator = 2 * first * minorLength + majorLength;
+    int minor = minor1 + minorStep * int(numerator / (2 * majorLength));
+    int64_t remainder = numerator % (2 * majorLength);
+
+    int major = major1 + majorStep * int(first);
+    for (int64_t i = first; i <= last; ++i, major += majorStep)
+    {
+        if (steep) imm2d_BlendPixel(minor, major, c);
+        else imm2d_BlendPixel(major, minor, c);
+
+        remainder += 2 * minorLength;
+        if (remainder >= 2 * majorLength) { remainder -= 2 * majorLength; minor += minorStep; }
+    }
+}
+
+// Fills every pixel within thickness/2 of the line (which gives it round end caps), one
+// row at a time.  Each row of that "capsule" shape is a single span, found by overlapping
+// where the row crosses the end circles and the band between them.
+static void imm2d_ThickLine(float x1, float y1, float x2, float y2, float thickness, Color c)
+{
+    if (thickness <= 1.0f) { imm2d_ThinLine(x1, y1, x2, y2, c); return; }
+
+    const float r = thickness / 2;
+    const float dx = x2 - x1, dy = y2 - y1;
+    const float length = std::sqrt(dx * dx + dy * dy);
+
+    const int top = std::max(0, int(std::floor(std::min(y1, y2) - r)));
+    const int bottom = std::min(Height - 1, int(std::ceil(std::max(y1, y2) + r)));
+
+    for (int y = top; y <= bottom; ++y)
+    {
+        float left = INFINITY, right = -INFINITY;
+
+        // The round caps
+        for (const float *end : { &x1, &x2 })
+        {
+            const float ey = y - (end == &x1 ? y1 : y2);
+            const float halfWidth = r * r - ey * ey;
+            if (halfWidth < 0) continue;
+
+            const float w = std::sqrt(halfWidth);
+            left = std::min(left, *end - w);
+            right = std::max(right, *end + w);
+        }
+
+        // The band along the line: within r of it, and between the two ends.  Each of those
+        // is a pair of limits along the row, unless the line is horizontal (or vertical).
+        if (length > 0)
+        {
+            float lo = -INFINITY, hi = INFINITY;
+            const auto limit = [&](float slope, float offset, float min, float max) {
+                if (slope == 0) { if (offset < min || offset > max) hi = -INFINITY; return; }
+                const float a = (min - offset) / slope, b = (max - offset) / slope;
+                lo = std::max(lo, std::min(a, b));
+                hi = std::min(hi, std::max(a, b));
+            };
+
+            // Distance from the line: ((x - x1) * dy - (y - y1) * dx) / length, within +/- r
+            limit(dy, -x1 * dy - (y - y1) * dx, -r * length, r * length);
+
+            // How far along: ((x - x1) * dx + (y - y1) * dy) / length, within [0, length]
+            limit(dx, -x1 * dx + (y - y1) * dy, 0, length * length);
+
+            if (lo <= hi)
+            {
+                left = std::min(left, lo);
+                right = std::max(right, hi);
+            }
+        }
+
+        if (left <= right) imm2d_FillSpan(int(std::ceil(left)), int(std::floor(right)), y, c);
+    }
+}
+
+// Fills in every pixel whose center lands inside the circle, one span per row
+static void imm2d_FillCircle(float cx, float cy, float radius, Color c)
+{
+    if (radius <= 0) return;
+
+    const int top = std::max(0, int(std::floor(cy - radius)));
+    const int bottom = std::min(Height - 1, int(std::ceil(cy + radius)));
+    for (int y = top; y <= bottom; ++y)
+    {
+        const float dy = y + 0.5f - cy;
+        const float halfWidth = radius * radius - dy * dy;
+        if (halfWidth <= 0) continue;
+
+        const float w = std::sqrt(halfWidth);
+        imm2d_FillSpan(int(std::ceil(cx - w - 0.5f)), int(std::ceil(cx + w - 0.5f)) - 1, y, c);
+    }
+}
+
+// Midpoint circle algorithm: one octant is worked out and mirrored into the other seven
+static void imm2d_StrokeCircle(float cx, float cy, float radius, Color c)
+{
+    const int x0 = int(std::floor(cx + 0.5f)), y0 = int(std::floor(cy + 0.5f));
+    int x = int(std::floor(radius + 0.5f)), y = 0, error = 1 - x;
+
+    // Nothing on the screen is close enough to this circle to be touched by it
+    if (x0 + x < 0 || x0 - x >= Width || y0 + x < 0 || y0 - x >= Height) return;
+
+    while (x >= y)
+    {
+        const int px[] = { x, y, -y, -x, -x, -y, y, x };
+        const int py[] = { y, x, x, y, -y, -x, -x, -y };
+
+        // Where the octants meet, some of those points are the same pixel and translucent
+        // colors would get blended twice
+        const int step = (y == 0 || x == y) ? 2 : 1;
+        for (int i = 0; i < 8; i += step) imm2d_BlendPixel(x0 + px[i], y0 + py[i], c);
+
+        ++y;
+        if (error < 0) error += 2 * y + 1;
+        else { --x; error += 2 * (y - x) + 1; }
+    }
+}
+
+// A thick stroke along part of a circle, with round caps on both ends (just like DrawLine).
+// Each row crosses the ring in (at most) two spans, and each pixel in them is tested against
+// the sweep with a pair of cross products instead of trigonometry.  The caps always fit
+// inside the ring, so they're just one more test for those same pixels, and every pixel is
+// only blended once (even where a cap overlaps the rest of the arc).
+static void imm2d_StrokeArc(float x, float y, float radius, float thickness, Color c, float startRadians, float endRadians)
+{
+    const float r = std::max(0.5f, thickness / 2);
+    const float sweep = endRadians - startRadians;
+
+    // The documented angles increase upward (against screen y), so flip y for these.  A
+    // negative sweep covers the same pixels as a positive one from its other end.
+    const float from = sweep > 0 ? startRadians : endRadians, to = sweep > 0 ? endRadians : startRadians;
+    const float fromX = std::cos(from), fromY = std::sin(from), toX = std::cos(to), toY = std::sin(to);
+    const bool full = std::fabs(sweep) >= Tau, wide = std::fabs(sweep) > Tau / 2;
+
+    const auto inCap = [&](float dx, float dy) {
+        const float ax = dx - radius * fromX, ay = dy - radius * fromY;
+        const float bx = dx - radius * toX, by = dy - radius * toY;
+        return ax * ax + ay * ay <= r * r || bx * bx + by * by <= r * r;
+    };
+
+    const auto inSweep = [&](float dx, float dy) {
+        if (full) return true;
+        if (sweep == 0) return false;
+
+        // Counter-clockwise from the start, and clockwise from the end.  Past a half circle,
+        // it only has to be one of those.
+        const bool afterStart = fromX * dy - fromY * dx >= 0, beforeEnd = dx * toY - dy * toX >= 0;
+        return wide ? (afterStart || beforeEnd) : (afterStart && beforeEnd);
+    };
+
+    const float outer = radius + r, inner = radius - r;
+    const int top = std::max(0, int(std::floor(y - outer)));
+    const int bottom = std::min(Height - 1, int(std::ceil(y + outer)));
+    for (int py = top; py <= bottom; ++py)
+    {
+        const float dy = py - y;
+        const float outerSquared = outer * outer - dy * dy;
+        if (outerSquared < 0) continue;
+
+        const float wo = std::sqrt(outerSquared);
+        const float wi = (inner > 0 && inner * inner - dy * dy > 0) ? std::sqrt(inner * inner - dy * dy) : -1.0f;
+
+        // The left and right sides of the ring (which are one span if we're above or below the hole)
+        const float spans[2][2] = { { x - wo, wi >= 0 ? x - wi : x + wo }, { x + wi, x + wo } };
+        for (int i = 0; i < (wi >= 0 ? 2 : 1); ++i)
+        {
+            const int left = std::max(0, int(std::ceil(spans[i][0]))), right = std::min(Width - 1, int(std::floor(spans[i][1])));
+            if (full) { imm2d_FillSpan(left, right, py, c); continue; }
+
+            for (int px = left; px <= right; ++px)
+                if (inSweep(px - x, -dy) || inCap(px - x, -dy)) imm2d_BlendPixel(px, py, c);
+        }
+    }
+}
+
+//
+// Anti-aliasing
+//
+// Smooth edges come from working out exactly how much of each pixel a shape covers.
+// The shape is traced as an outline of short, straight edges, and each edge adds the
+// (signed) area it sweeps out to a grid of cells, just like stb_truetype and font-rs
+// do for font glyphs.  Adding up each row of cells from left to right then gives how
+// much of every pixel is inside the shape, which is how strongly its color gets blended.
+//
+// The edges' directions decide whether they add or subtract area, so a shape with a
+// hole in it (like a ring) traces the hole in the opposite direction.  Overlapping parts
+// that go the same way just stop adding once a pixel is completely covered.
+//
+
+// Turns one row of cells into how much of each pixel is covered (from 0 to 255)
+static void imm2d_ResolveCoverage(const float *cells, uint8_t *alpha, int count)
+{
+    float sum = 0;
+    int x = 0;
+
+#if defined(IMM2D_SSE2)
+    // The running total across four cells at once takes two shift-and-add steps
+    __m128 total = _mm_setzero_ps();
+    const __m128 signBit = _mm_set1_ps(-0.0f), one = _mm_set1_ps(1.0f), scale = _mm_set1_ps(255.0f), half = _mm_set1_ps(0.5f);
+    for (; x + 4 <= count; x += 4)
+    {
+        __m128 v = _mm_loadu_ps(cells + x);
+        v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 4)));
+        v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 8)));
+        v = _mm_add_ps(v, total);
+        total = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+
+        const __m128 covered = _mm_min_ps(_mm_andnot_ps(signBit, v), one);
+        const __m128i a = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(covered, scale), half));
+        const int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(a, a), a));
+        std::memcpy(alpha + x, &bytes, 4);
+    }
+    sum = _mm_cvtss_f32(total);
+#elif defined(IMM2D_NEON)
+    float32x4_t total = vdupq_n_f32(0);
+    const float32x4_t zero = vdupq_n_f32(0), one = vdupq_n_f32(1), half = vdupq_n_f32(0.5f);
+    for (; x + 4 <= count; x += 4)
+    {
+        float32x4_t v = vld1q_f32(cells + x);
+        v = vaddq_f32(v, vextq_f32(zero, v, 3));
+        v = vaddq_f32(v, vextq_f32(zero, v, 2));
+        v = vaddq_f32(v, total);
+        total = vdupq_n_f32(vgetq_lane_f32(v, 3));
+
+        const float32x4_t covered = vminq_f32(vabsq_f32(v), one);
+        const uint16x4_t a = vmovn_u32(vcvtq_u32_f32(vmlaq_n_f32(half, covered, 255.0f)));
+        const uint32_t bytes = vget_lane_u32(vreinterpret_u32_u8(vmovn_u16(vcombine_u16(a, a))), 0);
+        std::memcpy(alpha + x, &bytes, 4);
+    }
+    sum = vgetq_lane_f32(total, 0);
+#endif
+
+    for (; x < count; ++x)
+    {
+        sum += cells[x];
+        alpha[x] = uint8_t(std::min(1.0f, std::fabs(sum)) * 255.0f + 0.5f);
+    }
+}
+
+struct Imm2dCoverage
+{
+    // The part of the screen the current shape might touch (with two spare cells on the
+    // end of each row, because edges along the right side spill into the cells past it)
+    int left = 0, top = 0, width = 0, height = 0, stride = 0;
+
+    std::vector<float> cells;
+    std::vector<uint8_t> alpha;
+
+    // Which cells in each row were touched.  Everything outside of those adds up to nothing,
+    // so a long, thin line doesn't have to look at its whole bounding box.
+    std::vector<int> rowFirst, rowLast;
+
+    float startX = 0, startY = 0, lastX = 0, lastY = 0;
+
+    // Prepares an empty grid for a shape that stays inside these screen coordinates.
+    // Returns false (and nothing should be traced) if none of it is on the screen.
+    bool begin(float l, float t, float r, float b)
+    {
+        const auto toPixel = [](float v, int limit) { return int(std::max(0.0f, std::min(float(limit), v))); };
+        left = toPixel(std::floor(l), Width);
+        top = toPixel(std::floor(t), Height);
+        width = toPixel(std::ceil(r) + 1, Width) - left;
+        height = toPixel(std::ceil(b) + 1, Height) - top;
+        if (width <= 0 || height <= 0) return false;
+
+        stride = width + 2;
+        if (cells.size() < size_t(stride) * height) cells.resize(size_t(stride) * height);
+        if (alpha.size() < size_t(width)) alpha.resize(width);
+
+        rowFirst.assign(height, stride);
+        rowLast.assign(height, -1);
+
+        startX = startY = lastX = lastY = 0;
+        return true;
+    }
+
+    void moveTo(float x, float y) { close(); startX = lastX = x; startY = lastY = y; }
+    void lineTo(float x, float y) { edge(lastX, lastY, x, y); lastX = x; lastY = y; }
+    void close() { lineTo(startX, startY); }
+
+    // Continues the outline along a circle, from one angle to another (in screen angles,
+    // which increase clockwise), using edges short enough to never be a tenth of a pixel
+    // away from the real curve
+    void arcTo(float cx, float cy, float radius, float from, float to)
+    {
+        const float step = radius > 0.1f ? 2 * std::acos(1 - 0.1f / radius) : float(Tau) / 4;
+        const int segments = std::min(1024, std::max(1, int(std::ceil(std::fabs(to - from) / step))));
+        const double angle = double(to - from) / segments;
+
+        // The points in the middle are pushed out a little, so the straight edges between them
+        // cut off just as much of the circle as they add (which matters most for small circles).
+        // The ends stay put, since they have to meet up with the rest of the outline.
+        const float pushed = angle != 0 ? radius * float(std::sqrt(std::fabs(angle) / std::sin(std::fabs(angle)))) : radius;
+
+        // Each point is the one before it, rotated by the same small angle
+        const double stepCos = std::cos(angle), stepSin = std::sin(angle);
+        double dx = std::cos(from), dy = std::sin(from);
+        for (int i = 0; i <= segments; ++i)
+        {
+            const float r = (i == 0 || i == segments) ? radius : pushed;
+            lineTo(cx + r * float(dx), cy + r * float(dy));
+
+            const double rotated = dx * stepCos - dy * stepSin;
+            dy = dx * stepSin + dy * stepCos;
+            dx = rotated;
+        }
+    }
+
+    void edge(float x0, float y0, float x1, float y1)
+    {
+        x0 -= left; x1 -= left;
+        y0 -= top; y1 -= top;
+
+        if (std::fabs(y1 - y0) <= 1e-6f) return;
+        const float direction = y0 < y1 ? 1.0f : -1.0f;
+        if (y0 > y1) { std::swap(x0, x1); std::swap(y0, y1); }
+        if (y1 <= 0 || y0 >= height) return;
+
+        const float dxdy = (x1 - x0) / (y1 - y0);
+        if (y0 < 0) { x0 -= y0 * dxdy; y0 = 0; }
+        if (y1 > height) { x1 -= (y1 - height) * dxdy; y1 = float(height); }
+
+        const float right = float(width);
+        if (x0 >= 0 && x1 >= 0 && x0 <= right && x1 <= right) { accumulate(x0, y0, y1, dxdy, direction); return; }
+
+        // The parts of an edge past the left or right side of the grid still count for every
+        // pixel beside them, so those parts are flattened against that side instead.  That
+        // means splitting the edge wherever it crosses one.
+        float cuts[4] = { y0, y1, y1, y1 };
+        int count = 1;
+        for (const float side : { 0.0f, right })
+            if ((x0 - side) * (x1 - side) < 0) cuts[count++] = std::max(y0, std::min(y1, y0 + (side - x0) / dxdy));
+        if (count == 3 && cuts[2] < cuts[1]) std::swap(cuts[1], cuts[2]);
+        cuts[count] = y1;
+
+        for (int i = 0; i < count; ++i)
+        {
+            const float y = cuts[i], middle = x0 + ((y + cuts[i + 1]) / 2 - y0) * dxdy;
+            if (middle >= 0 && middle <= right) accumulate(x0 + (y - y0) * dxdy, y, cuts[i + 1], dxdy, direction);
+            else accumulate(middle < 0 ? 0 : right, y, cuts[i + 1], 0, direction);
+        }
+    }
+
+    // Adds the area to the right of an edge (which has to be inside the grid, going down
+    // from (x0, y0) to y1) to each row of cells it crosses
+    void accumulate(float x0, float y0, float y1, float dxdy, float direction)
+    {
+        if (y1 <= y0) return;
+        float x = std::max(0.0f, std::min(float(width), x0));
+
+        // Everything in here is positive, so truncating is the same as rounding down (and
+        // is a lot quicker than std::floor and std::ceil when they aren't a single instruction)
+        const auto roundUp = [](float v) { const int i = int(v); return i + (float(i) < v); };
+
+        const int last = std::min(height, roundUp(y1));
+        for (int y = int(y0); y < last; ++y)
+        {
+            float *row = &cells[size_t(y) * stride];
+
+            const float dy = std::min(float(y + 1), y1) - std::max(float(y), y0);
+            const float next = std::max(0.0f, std::min(float(width), x + dxdy * dy));
+            const float d = dy * direction;
+
+            const float lo = std::min(x, next), hi = std::max(x, next);
+            const int loCell = int(lo), hiCell = roundUp(hi);
+            const float loFloor = float(loCell);
+
+            if (hiCell <= loCell + 1)
+            {
+                // The edge stays inside one pixel on this row, which keeps the part of its area
+                // that's to the right of the edge.  The cell after it gets the rest.
+                const float middle = 0.5f * (x + next) - loFloor;
+                row[loCell] += d - d * middle;
+                row[loCell + 1] += d * middle;
+            }
+            else
+            {
+                // Otherwise the area is split up along the pixels it crosses: a triangle at
+                // each end and an equal share for every pixel in between
+                const float s = 1.0f / (hi - lo);
+                const float loPart = lo - loFloor, hiPart = hi - hiCell + 1;
+                const float first = 0.5f * s * (1 - loPart) * (1 - loPart);
+                const float final = 0.5f * s * hiPart * hiPart;
+
+                row[loCell] += d * first;
+                if (hiCell == loCell + 2) row[loCell + 1] += d * (1 - first - final);
+                else
+                {
+                    const float second = s * (1.5f - loPart);
+                    row[loCell + 1] += d * (second - first);
+                    for (int i = loCell + 2; i < hiCell - 1; ++i) row[i] += d * s;
+
+                    const float beforeLast = second + (hiCell - loCell - 3) * s;
+                    row[hiCell - 1] += d * (1 - beforeLast - final);
+                }
+                row[hiCell] += d * final;
+            }
+
+            rowFirst[y] = std::min(rowFirst[y], loCell);
+            rowLast[y] = std::max(rowLast[y], hiCell + 1);
+            x = next;
+        }
+    }
+
+    // Blends c into every pixel the outline covers, and leaves the grid empty again
+    void fill(Color c)
+    {
+        close();
+
+        for (int y = 0; y < height; ++y)
+        {
+            const int first = rowFirst[y];
+            if (first > rowLast[y]) continue;
+
+            // Edges flattened against the right side only touch the spare cells past the last
+            // pixel, so there may be nothing to draw on this row.  Those cells still have to be
+            // cleared, though, or they'd turn up in some later shape.
+            float *row = &cells[size_t(y) * stride];
+            const int last = std::min(rowLast[y], width - 1);
+            if (first <= last)
+            {
+                const int count = last - first + 1;
+                imm2d_ResolveCoverage(row + first, alpha.data(), count);
+                imm2d_BlendMask(imm2d_PixelAt(left + first, top + y), alpha.data(), size_t(count), c);
+            }
+
+            std::fill(row + first, row + std::min(stride, rowLast[y] + 1), 0.0f);
+        }
+    }
+};
+
+// Only used while bitmapLock is held
+static Imm2dCoverage imm2d_coverage;
+
+// Like the hard-edged versions above, strokes are centered on whole coordinates (but the
+// coverage grid puts those on pixel corners, so they're moved half a pixel) and fills aren't
+
+// A line (at least one pixel thick) with round caps: two half circles, joined up
+static void imm2d_SmoothLine(float x1, float y1, float x2, float y2, float thickness, Color c)
+{
+    const float r = std::max(1.0f, thickness) / 2;
+    x1 += 0.5f; y1 += 0.5f;
+    x2 += 0.5f; y2 += 0.5f;
+
+    auto &g = imm2d_coverage;
+    if (!g.begin(std::min(x1, x2) - r, std::min(y1, y2) - r, std::max(x1, x2) + r, std::max(y1, y2) + r)) return;
+
+    const float angle = std::atan2(y2 - y1, x2 - x1), quarter = float(Tau) / 4;
+    g.moveTo(x2 + r * std::cos(angle - quarter), y2 + r * std::sin(angle - quarter));
+    g.arcTo(x2, y2, r, angle - quarter, angle + quarter);
+    g.arcTo(x1, y1, r, angle + quarter, angle + 3 * quarter);
+    g.fill(c);
+}
+
+// Everything between two circles (or inside the outer one if inner isn't positive)
+static void imm2d_SmoothRing(float cx, float cy, float outer, float inner, Color c)
+{
+    auto &g = imm2d_coverage;
+    if (outer <= 0 || !g.begin(cx - outer, cy - outer, cx + outer, cy + outer)) return;
+
+    g.moveTo(cx + outer, cy);
+    g.arcTo(cx, cy, outer, 0, float(Tau));
+
+    if (inner > 0)
+    {
+        g.moveTo(cx + inner, cy);
+        g.arcTo(cx, cy, inner, float(Tau), 0);
+    }
+
+    g.fill(c);
+}
+
+static void imm2d_SmoothFillCircle(float cx, float cy, float radius, Color c)
+{
+    imm2d_SmoothRing(cx, cy, radius, 0, c);
+}
+
+static void imm2d_SmoothStrokeCircle(float cx, float cy, float radius, Color c)
+{
+    imm2d_SmoothRing(cx + 0.5f, cy + 0.5f, radius + 0.5f, radius - 0.5f, c);
+}
+
+static void imm2d_SmoothArc(float x, float y, float radius, float thickness, Color c, float startRadians, float endRadians)
+{
+    const float r = std::max(0.5f, thickness / 2);
+    const float outer = radius + r, inner = radius - r;
+    x += 0.5f; y += 0.5f;
+
+    if (std::fabs(endRadians - startRadians) >= Tau) { imm2d_SmoothRing(x, y, outer, inner, c); return; }
+
+    auto &g = imm2d_coverage;
+    if (!g.begin(x - outer, y - outer, x + outer, y + outer)) return;
+
+    // The documented angles increase upward, so they're flipped into screen angles (which
+    // also puts them in increasing order, however the arc was given)
+    const float from = -std::max(startRadians, endRadians), to = -std::min(startRadians, endRadians);
+    const float fromX = x + radius * std::cos(from), fromY = y + radius * std::sin(from);
+    const float toX = x + radius * std::cos(to), toY = y + radius * std::sin(to);
+    const float half = float(Tau) / 2;
+
+    if (inner > 0)
+    {
+        // Along the outside, around the end cap, back along the inside, and around the start cap
+        g.moveTo(x + outer * std::cos(from), y + outer * std::sin(from));
+        g.arcTo(x, y, outer, from, to);
+        g.arcTo(toX, toY, r, to, to + half);
+        g.arcTo(x, y, inner, to, from);
+        g.arcTo(fromX, fromY, r, from + half, from + 2 * half);
+    }
+    else
+    {
+        // Without a hole, it's a pie slice with a circle on each end.  (Their edges are a
+        // little too dark where they cross, but only for arcs thicker than they are wide.)
+        g.moveTo(x, y);
+        g.arcTo(x, y, outer, from, to);
+        for (const float *end : { &fromX, &toX })
+        {
+            const float ex = *end, ey = end == &fromX ? fromY : toY;
+            g.moveTo(ex + r, ey);
+            g.arcTo(ex, ey, r, 0, 2 * half);
+        }
+    }
+
+    g.fill(c);
+}
+
+// The fill covers every pixel from (x, y) to (x + width - 1, y + height - 1), and the
+// stroke is the outermost ring of pixels in that same area.  (Both of these are always
+// drawn directly: they're already exactly on the pixel grid, so GDI+ couldn't anti-alias
+// them anyway, and its pen was one pixel off from its brush.)
+static void imm2d_DrawRectangle(int x, int y, int width, int height, Color fill, Color stroke)
+{
+    if (width <= 0 || height <= 0) return;
+
+    // Anything much past the edge of the screen is the same as the edge itself
+    const int right = int(std::min<int64_t>(int64_t(x) + width, Width + 1));
+    const int bottom = int(std::min<int64_t>(int64_t(y) + height, Height + 1));
+
+    if (fill != Transparent) imm2d_FillRect(x, y, right, bottom, fill);
+
+    if (stroke != Transparent)
+    {
+        imm2d_FillRect(x, y, right, y + 1, stroke);
+        if (bottom - y > 1) imm2d_FillRect(x, bottom - 1, right, bottom, stroke);
+
+        imm2d_FillRect(x, y + 1, x + 1, bottom - 1, stroke);
+        if (right - x > 1) imm2d_FillRect(right - 1, y + 1, right, bottom - 1, stroke);
+    }
+
+    imm2d_SetDirty(x, y, right, bottom);
+}
+
+// Like GDI+'s Clear, this replaces every pixel without blending
+static void imm2d_Clear(Color c)
+{
+    imm2d_FillPixels(imm2d_pixels.data(), imm2d_pixels.size(), c);
+    imm2d_SetDirty(0, 0, Width, Height);
+}
+
+static void imm2d_DrawLine(float x1, float y1, float x2, float y2, float thickness, Color c)
+{
+    if (imm2d_antiAliased) imm2d_SmoothLine(x1, y1, x2, y2, thickness, c);
+    else imm2d_ThickLine(x1, y1, x2, y2, thickness, c);
+
+    imm2d_SetDirty(std::min(x1, x2) - thickness / 2, std::min(y1, y2) - thickness / 2, std::max(x1, x2) + thickness / 2, std::max(y1, y2) + thickness / 2);
+}
+
+static void imm2d_DrawCircle(float x, float y, float radius, Color fill, Color stroke)
+{
+    if (fill != Transparent)
+    {
+        if (imm2d_antiAliased) imm2d_SmoothFillCircle(x, y, radius, fill);
+        else imm2d_FillCircle(x, y, radius, fill);
+    }
+
+    if (stroke != Transparent)
+    {
+        if (imm2d_antiAliased) imm2d_SmoothStrokeCircle(x, y, radius, stroke);
+        else imm2d_StrokeCircle(x, y, radius, stroke);
+    }
+
+    imm2d_SetDirty(x - radius, y - radius, x + radius, y + radius);
+}
+
+static void imm2d_DrawArc(float x, float y, float radius, float thickness, Color c, float startRadians, float endRadians)
+{
+    if (imm2d_antiAliased) imm2d_SmoothArc(x, y, radius, thickness, c, startRadians, endRadians);
+    else imm2d_StrokeArc(x, y, radius, thickness, c, startRadians, endRadians);
+
+    const float extent = radius + std::max(0.5f, thickness / 2);
+    imm2d_SetDirty(x - extent, y - extent, x + extent, y + extent);
+}
+
+
+//
+// Built-in font
+//
+// The 5-pixel font from the Text example, so there is always something to draw text
+// with (even without GDI+).  Each row of each letter is saved as a handful of bits,
+// which turn into a few runs of solid pixels when it's drawn.
+//
+
+// Each letter's columns are packed top-to-bottom, left-to-right into the low bits of one
+// number, with the letter's width in the top four.  These start with ' ' (ASCII 32).
+static constexpr uint32_t imm2d_pixelFontPacked[96] = {
+    0x10000000, 0x10000017, 0x30000C03, 0x50AFABEA, 0x509AFEB2, 0x30004C99, 0x400A26AA, 0x10000003, 0x2000022E, 0x200001D1, 0x30001445, 0x300011C4, 0x10000018, 0x30001084, 0x10000010, 0x30000C98,
+    0x30003A2E, 0x300043F2, 0x30004AB9, 0x30006EB1, 0x30007C87, 0x300026B7, 0x300076BF, 0x30007C21, 0x30006EBB, 0x30007EB7, 0x1000000A, 0x1000001A, 0x30004544, 0x4005294A, 0x30001151, 0x30000AA1,
+    0x506ADE2E, 0x300078BE, 0x30002ABF, 0x3000462E, 0x30003A3F, 0x300046BF, 0x300004BF, 0x3000662E, 0x30007C9F, 0x1000001F, 0x30003E08, 0x30006C9F, 0x3000421F, 0x51F1105F, 0x51F4105F, 0x4007462E,
+    0x300008BF, 0x400F662E, 0x300068BF, 0x300026B2, 0x300007E1, 0x30007E1F, 0x30003E0F, 0x50F8320F, 0x30006C9B, 0x30000F83, 0x30004EB9, 0x2000023F, 0x30006083, 0x200003F1, 0x30000822, 0x30004210,
+    0x20000041, 0x300078BE, 0x30002ABF, 0x3000462E, 0x30003A3F, 0x300046BF, 0x300004BF, 0x3000662E, 0x30007C9F, 0x1000001F, 0x30003E08, 0x30006C9F, 0x3000421F, 0x51F1105F, 0x51F4105F, 0x4007462E,
+    0x300008BF, 0x400F662E, 0x300068BF, 0x300026B2, 0x300007E1, 0x30007E1F, 0x30003E0F, 0x50F8320F, 0x30006C9B, 0x30000F83, 0x30004EB9, 0x30004764, 0x1000001F, 0x30001371, 0x50441044, 0x00000000,
+};
+
+// The same letters turned on their side (once, while compiling) so each row can be
+// drawn on its own
+struct Imm2dPixelFont
+{
+    static constexpr int LetterHeight = 5, LineHeight = 6;
+
+    uint8_t widths[96]{};
+
+    // Bit 0 of each row is the letter's leftmost column
+    uint8_t rows[96][LetterHeight]{};
+
+    constexpr Imm2dPixelFont()
+    {
+        for (int i = 0; i < 96; ++i)
+        {
+            uint32_t bits = imm2d_pixelFontPacked[i];
+            widths[i] = uint8_t(bits >> 28);
+
+            for (int x = 0; x < widths[i]; ++x)
+                for (int y = 0; y < LetterHeight; ++y, bits >>= 1)
+                    if (bits & 1) rows[i][y] |= uint8_t(1 << x);
+        }
+    }
+};
+
+static constexpr Imm2dPixelFont imm2d_pixelFont;
+
+// Size 5 is the font's real size; every 5 more makes each of its pixels a bigger square
+static int imm2d_PixelFontScale(int fontPtSize) { return std::max(1, fontPtSize / 5); }
+
+// Letters are one (scaled) pixel apart, and anything the font doesn't have is skipped
+static int imm2d_PixelFontWidth(const char *text, const char *end, int scale)
+{
+    int width = 0;
+    for (const char *p = text; p < end; ++p)
+    {
+        const uint8_t ch = uint8_t(*p);
+        if (ch < 32 || ch > 127 || imm2d_pixelFont.widths[ch - 32] == 0) continue;
+        width += (imm2d_pixelFont.widths[ch - 32] + 1) * scale;
+    }
+
+    return std::max(0, width - scale);
+}
+
+static int imm2d_PixelFontMeasure(const char *text, int scale)
+{
+    int widest = 0;
+    for (const char *line = text; ; )
+    {
+        const char *end = std::strchr(line, '\n');
+        if (!end) end = line + std::strlen(line);
+
+        widest = std::max(widest, imm2d_PixelFontWidth(line, end, scale));
+
+        if (!*end) return widest;
+        line = end + 1;
+    }
+}
+
+// Calls run(x, y, length) for every horizontal run of solid pixels in the text
+template <typename Run>
+static void imm2d_PixelFontRuns(int x, int y, const char *text, int scale, bool centered, Run run)
+{
+    for (const char *line = text; ; y += Imm2dPixelFont::LineHeight * scale)
+    {
+        const char *end = std::strchr(line, '\n');
+        if (!end) end = line + std::strlen(line);
+
+        int pen = centered ? x - imm2d_PixelFontWidth(line, end, scale) / 2 : x;
+        for (const char *p = line; p < end; ++p)
+        {
+            const uint8_t ch = uint8_t(*p);
+            if (ch < 32 || ch > 127) continue;
+
+            const int width = imm2d_pixelFont.widths[ch - 32];
+            if (width == 0) continue;
+
+            for (int row = 0; row < Imm2dPixelFont::LetterHeight; ++row)
+            {
+                const uint32_t bits = imm2d_pixelFont.rows[ch - 32][row];
+                for (int col = 0; col < width; )
+                {
+                    if (!((bits >> col) & 1)) { ++col; continue; }
+
+                    const int start = col;
+                    while (col < width && ((bits >> col) & 1)) ++col;
+
+                    for (int i = 0; i < scale; ++i) run(pen + start * scale, y + row * scale + i, (col - start) * scale);
+                }
+            }
+
+            pen += (width + 1) * scale;
+        }
+
+        if (!*end) return;
+        line = end + 1;
+    }
+}
+
+static void imm2d_DrawPixelFont(int x, int y, const char *text, int fontPtSize, Color c, bool centered)
+{
+    imm2d_PixelFontRuns(x, y, text, imm2d_PixelFontScale(fontPtSize), centered, [c](int left, int top, int length) { imm2d_DrawSpan(left, top, length, c); });
+}
+
+// For the public DrawString functions that draw into the caller's own list of values
+template <typename T>
+static void imm2d_PixelFontInto(T *values, int width, int height, int x, int y, const char *text, T value, bool centered)
+{
+    if (!values || !text || width <= 0 || height <= 0) return;
+
+    imm2d_PixelFontRuns(x, y, text, 1, centered, [&](int left, int top, int length) {
+        if (top < 0 || top >= height) return;
+
+        const int right = std::min(left + length, width);
+        left = std::max(left, 0);
+        if (left < right) std::fill(values + size_t(top) * width + left, values + size_t(top) * width + right, value);
+    });
+}
+
+#ifndef IMM2D_HEADLESS
+
+// Lets GDI+ draw directly into one of our pixel buffers
+static std::unique_ptr<Gdiplus::Bitmap> imm2d_WrapPixels(std::vector<uint32_t> &pixels)
+{
+    return std::make_unique<Gdiplus::Bitmap>(Width, Height, Width * int(sizeof(uint32_t)), PixelFormat32bppARGB, reinterpret_cast<BYTE *>(pixels.data()));
+}
+
+// Points a Bitmap/Graphics pair at a pixel buffer whose memory has moved (keeping the
+// current anti-aliasing setting).  Nothing is copied; GDI+ just gets a new address.
+static void imm2d_Rewrap(std::vector<uint32_t> &pixels, std::unique_ptr<Gdiplus::Bitmap> &bitmap, std::unique_ptr<Gdiplus::Graphics> &graphics)
+{
+    const Gdiplus::SmoothingMode smoothing = graphics ? graphics->GetSmoothingMode() : Gdiplus::SmoothingModeNone;
+
+    graphics.reset();
+    bitmap = imm2d_WrapPixels(pixels);
+    graphics = std::make_unique<Gdiplus::Graphics>(bitmap.get());
+    graphics->SetSmoothingMode(smoothing);
+}
+
+void imm2d_setAntiAliasing(bool enabled)
+{
+    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+    if (!imm2d_graphics) return;
+
+    imm2d_antiAliased = enabled;
+    imm2d_graphics->SetSmoothingMode(enabled ? Gdiplus::SmoothingModeAntiAlias : Gdiplus::SmoothingModeNone);
+    imm2d_graphicsOther->SetSmoothingMode(enabled ? Gdiplus::SmoothingModeAntiAlias : Gdiplus::SmoothingModeNone);
+}
+
+void UseAntiAliasing() { imm2d_setAntiAliasing(true); }
+void StopAntiAliasing() { imm2d_setAntiAliasing(false); }
+
+
+// The rest of these are only called while bitmapLock is held (and after the
+// drawing surfaces exist) by the public drawing functions further below.  Each
+// one marks whatever part of the surface it might have changed as dirty.
+
+static Gdiplus::Font *imm2d_GetFont(const char *name, int size)
+{
+    const std::pair<std::string, int> key{ name, size };
+
+    auto &font = imm2d_fonts[key];
+    if (!font) font = std::make_unique<Gdiplus::Font>(imm2d_ToWide(name).c_str(), static_cast<Gdiplus::REAL>(size));
+    return font.get();
+}
+
+// Lets GDI+ lay out and draw the whole string itself, which is how all text used to be drawn
+static void imm2d_DrawStringDirect(int x, int y, const char *text, const char *fontName, int fontPtSize, const Color c, bool centered)
+{
+    const auto wide = imm2d_ToWide(text);
+    const auto font = imm2d_GetFont(fontName, fontPtSize);
+    const Gdiplus::SolidBrush brush(c);
+    const Gdiplus::PointF origin{ static_cast<Gdiplus::REAL>(x), static_cast<Gdiplus::REAL>(y) };
+    Gdiplus::StringFormat format;
+    format.SetAlignment(centered ? Gdiplus::StringAlignmentCenter : Gdiplus::StringAlignmentNear);
+
+    imm2d_graphics->SetTextRenderingHint(imm2d_antiAliased ? Gdiplus::TextRenderingHintAntiAlias : Gdiplus::TextRenderingHintSingleBitPerPixelGridFit);
+    imm2d_graphics->DrawString(wide.c_str(), static_cast<INT>(wide.length()), font, origin, &format, &brush);
+
+    Gdiplus::RectF bounds;
+    imm2d_graphics->MeasureString(wide.c_str(), static_cast<INT>(wide.length()), font, origin, &format, &bounds);
+    imm2d_SetDirty(bounds.X, bounds.Y, bounds.X + bounds.Width, bounds.Y + bounds.Height);
+}
+
+
+//
+// Text
+//
+// GDI+ is slow to lay out and draw text, and most programs draw the same few strings
+// over and over (like a score in the corner).  So each character is only drawn by GDI+
+// once for each font, size, and anti-aliasing setting, into a grayscale "atlas" that
+// they all share.  After that, drawing a string just blends those saved shapes onto the
+// screen in whatever color was asked for.
+//
+
+struct Imm2dGlyph
+{
+    // Where the shape is saved in the atlas (if it has one; spaces don't)
+    int page = 0, x = 0, y = 0, width = 0, height = 0;
+
+    // Where the shape's top-left corner goes, measured from the pen on the top of the line
+    int left = 0, top = 0;
+
+    // How far the pen moves to the right afterward
+    float advance = 0;
+};
+
+struct Imm2dGlyphFace
+{
+    Gdiplus::Font *font = nullptr;
+    bool antiAliased = false;
+
+    // GDI+ leaves a little room before the first character of a string, which is kept
+    // so text still lands in the same place it always did
+    float padding = 0, lineHeight = 0;
+
+    std::unordered_map<uint32_t, Imm2dGlyph> glyphs;
+};
+
+struct Imm2dGlyphAtlas
+{
+    static constexpr int PageSize = 512, MaxPages = 16;
+
+    std::vector<std::vector<uint8_t>> pages;
+    int shelfX = 0, shelfY = 0, shelfHeight = 0;
+
+    // Goes up every time the atlas starts over, so anything that remembers where a
+    // shape used to be can tell that it isn't there anymore
+    int generation = 0;
+
+    // Finds room for a shape, left to right along "shelves" as tall as the tallest shape
+    // on each one.  Returns false if every page is full.
+    bool place(Imm2dGlyph &g)
+    {
+        if (shelfX + g.width > PageSize) { shelfX = 0; shelfY += shelfHeight; shelfHeight = 0; }
+        if (pages.empty() || shelfY + g.height > PageSize)
+        {
+            if (pages.size() == MaxPages) return false;
+            pages.emplace_back(size_t(PageSize) * PageSize, uint8_t(0));
+            shelfX = shelfY = shelfHeight = 0;
+        }
+
+        g.page = int(pages.size()) - 1;
+        g.x = shelfX;
+        g.y = shelfY;
+
+        // (Leaving a gap between shapes keeps them from bleeding into each other)
+        shelfX += g.width + 1;
+        shelfHeight = std::max(shelfHeight, g.height + 1);
+        return true;
+    }
+
+    void clear() { pages.clear(); shelfX = shelfY = shelfHeight = 0; ++generation; }
+};
+
+// These are only used while bitmapLock is held
+static std::map<std::tuple<std::string, int, bool>, Imm2dGlyphFace> imm2d_glyphFaces;
+static Imm2dGlyphAtlas imm2d_glyphAtlas;
+static std::unique_ptr<Gdiplus::StringFormat> imm2d_typographic;
+
+static Imm2dGlyphFace &imm2d_GetGlyphFace(const char *fontName, int fontPtSize, bool antiAliased)
+{
+    Imm2dGlyphFace &face = imm2d_glyphFaces[std::make_tuple(std::string(fontName), fontPtSize, antiAliased)];
+    if (face.font) return face;
+
+    // Measuring "typographically" skips the extra room GDI+ normally leaves around text
+    if (!imm2d_typographic)
+    {
+        imm2d_typographic = std::make_unique<Gdiplus::StringFormat>(Gdiplus::StringFormat::GenericTypographic());
+        imm2d_typographic->SetFormatFlags(imm2d_typographic->GetFormatFlags() | Gdiplus::StringFormatFlagsMeasureTrailingSpaces);
+    }
+
+    face.font = imm2d_GetFont(fontName, fontPtSize);
+    face.antiAliased = antiAliased;
+    face.lineHeight = face.font->GetHeight(imm2d_graphics.get());
+
+    Gdiplus::RectF normal, typographic;
+    const Gdiplus::StringFormat format;
+    imm2d_graphics->MeasureString(L"x", 1, face.font, Gdiplus::PointF(0, 0), &format, &normal);
+    imm2d_graphics->MeasureString(L"x", 1, face.font, Gdiplus::PointF(0, 0), imm2d_typographic.get(), &typographic);
+    face.padding = (normal.Width - typographic.Width) / 2;
+
+    return face;
+}
+
+static const Imm2dGlyph &imm2d_GetGlyph(Imm2dGlyphFace &face, uint32_t codepoint)
+{
+    const auto found = face.glyphs.find(codepoint);
+    if (found != face.glyphs.end()) return found->second;
+
+    // Characters past U+FFFF take two UTF-16 "surrogates"
+    wchar_t wide[2] = { wchar_t(codepoint), 0 };
+    int length = 1;
+    if (codepoint > 0xFFFF)
+    {
+        wide[0] = wchar_t(0xD800 + ((codepoint - 0x10000) >> 10));
+        wide[1] = wchar_t(0xDC00 + ((codepoint - 0x10000) & 0x3FF));
+        length = 2;
+    }
+
+    Imm2dGlyph glyph;
+    Gdiplus::RectF bounds;
+    imm2d_graphics->MeasureString(wide, length, face.font, Gdiplus::PointF(0, 0), imm2d_typographic.get(), &bounds);
+    glyph.advance = bounds.Width;
+
+    // Draw the character by itself in white, with plenty of room around it for any parts
+    // that lean past its edges, and then keep only the part that isn't empty
+    const int margin = int(std::ceil(face.lineHeight / 2)) + 1;
+    const int cellWidth = int(std::ceil(glyph.advance)) + 2 * margin, cellHeight = int(std::ceil(face.lineHeight)) + 2 * margin;
+
+    Gdiplus::Bitmap cell(cellWidth, cellHeight, PixelFormat32bppARGB);
+    cell.SetResolution(imm2d_bitmap->GetHorizontalResolution(), imm2d_bitmap->GetVerticalResolution());
+    {
+        Gdiplus::Graphics graphics(&cell);
+        graphics.Clear(Gdiplus::Color(0, 0, 0, 0));
+        graphics.SetTextRenderingHint(face.antiAliased ? Gdiplus::TextRenderingHintAntiAlias : Gdiplus::TextRenderingHintSingleBitPerPixelGridFit);
+
+        const Gdiplus::SolidBrush white(Gdiplus::Color(255, 255, 255, 255));
+        graphics.DrawString(wide, length, face.font, Gdiplus::PointF(float(margin), float(margin)), imm2d_typographic.get(), &white);
+    }
+
+    Gdiplus::BitmapData data;
+    Gdiplus::Rect all(0, 0, cellWidth, cellHeight);
+    if (cell.LockBits(&all, Gdiplus::ImageLockModeRead, PixelFormat32bppARGB, &data) == Gdiplus::Ok)
+    {
+        const auto alphaAt = [&](int x, int y) { return static_cast<const uint8_t *>(data.Scan0)[y * data.Stride + x * 4 + 3]; };
+
+        int left = cellWidth, top = cellHeight, right = -1, bottom = -1;
+        for (int y = 0; y < cellHeight; ++y)
+            for (int x = 0; x < cellWidth; ++x)
+                if (alphaAt(x, y) != 0)
+                {
+                    left = std::min(left, x);
+                    top = std::min(top, y);
+                    right = std::max(right, x);
+                    bottom = std::max(bottom, y);
+                }
+
+        if (right >= left)
+        {
+            glyph.width = right - left + 1;
+            glyph.height = bottom - top + 1;
+            glyph.left = left - margin;
+            glyph.top = top - margin;
+
+            // When the atlas fills up (from lots of different fonts or a huge alphabet), it
+            // starts over and anything still in use is simply drawn into it again
+            if (!imm2d_glyphAtlas.place(glyph))
+            {
+                imm2d_glyphAtlas.clear();
+                for (auto &f : imm2d_glyphFaces) f.second.glyphs.clear();
+                imm2d_glyphAtlas.place(glyph);
+            }
+
+            uint8_t *page = imm2d_glyphAtlas.pages[glyph.page].data();
+            for (int y = 0; y < glyph.height; ++y)
+                for (int x = 0; x < glyph.width; ++x)
+                    page[size_t(glyph.y + y) * Imm2dGlyphAtlas::PageSize + glyph.x + x] = alphaAt(left + x, top + y);
+        }
+
+        cell.UnlockBits(&data);
+    }
+
+    return face.glyphs[codepoint] = glyph;
+}
+
+static bool imm2d_IsPixelFont(const char *fontName) { return std::strcmp(fontName, PixelFont) == 0; }
+
+// Where every letter of a string goes (measured from the x and y it's drawn at) and
+// where its shape is saved in the atlas
+struct Imm2dTextLayout
+{
+    struct Placed { int page, atlasX, atlasY, width, height, left, top; };
+
+    std::vector<Placed> glyphs;
+    int width = 0;
+    int generation = 0;
+};
+
+static Imm2dTextLayout imm2d_LayoutString(Imm2dGlyphFace &face, const char *text, bool centered)
+{
+    Imm2dTextLayout layout;
+
+    // If the atlas has to start over partway through, the letters placed before that
+    // point have moved, so it's laid out once more (which will fit unless a single
+    // string uses more letters than the whole atlas can hold)
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        layout.glyphs.clear();
+        layout.generation = imm2d_glyphAtlas.generation;
+
+        float widest = 0, lineTop = 0;
+        for (const char *line = text; ; lineTop += face.lineHeight)
+        {
+            const char *lineEnd = line;
+            while (*lineEnd && *lineEnd != '\n') ++lineEnd;
+
+            // (Windows-style "\r\n" line endings shouldn't draw anything extra)
+            const char *textEnd = lineEnd;
+            if (textEnd > line && textEnd[-1] == '\r') --textEnd;
+
+            float width = 0;
+            for (const char *p = line; p < textEnd; ) width += imm2d_GetGlyph(face, imm2d_NextCodepoint(p, textEnd)).advance;
+            widest = std::max(widest, width);
+
+            // Like GDI+, each line is either centered on x or starts there
+            float pen = centered ? -width / 2 : face.padding;
+            for (const char *p = line; p < textEnd; )
+            {
+                const Imm2dGlyph &g = imm2d_GetGlyph(face, imm2d_NextCodepoint(p, textEnd));
+                if (g.width > 0) layout.glyphs.push_back({ g.page, g.x, g.y, g.width, g.height, int(std::floor(pen + 0.5f)) + g.left, int(std::floor(lineTop + 0.5f)) + g.top });
+                pen += g.advance;
+            }
+
+            if (!*lineEnd) break;
+            line = lineEnd + 1;
+        }
+
+        layout.width = int(std::ceil(widest + 2 * face.padding));
+        if (layout.generation == imm2d_glyphAtlas.generation) break;
+    }
+
+    return layout;
+}
+
+//
+// Strings are looked up in a small least-recently-used cache before they're laid out.
+// The most recently used string is at the front of the list, and when there are too
+// many, the one at the back is forgotten.
+//
+
+struct Imm2dTextKey
+{
+    std::string text, font;
+    int size;
+    bool antiAliased, centered;
+
+    bool operator==(const Imm2dTextKey &o) const { return size == o.size && antiAliased == o.antiAliased && centered == o.centered && text == o.text && font == o.font; }
+};
+
+struct Imm2dTextKeyHash
+{
+    size_t operator()(const Imm2dTextKey &k) const
+    {
+        // FNV-1a over the text and font name, mixed with the rest
+        uint64_t h = 14695981039346656037ull;
+        for (const unsigned char ch : k.text) h = (h ^ ch) * 1099511628211ull;
+        h = (h ^ 0xFF) * 1099511628211ull;
+        for (const unsigned char ch : k.font) h = (h ^ ch) * 1099511628211ull;
+        h ^= (uint64_t(k.size) << 2) | (uint64_t(k.antiAliased) << 1) | uint64_t(k.centered);
+        return size_t(h * 1099511628211ull);
+    }
+};
+
+static constexpr size_t imm2d_textCacheCapacity = 256;
+
+// These are only used while bitmapLock is held
+static std::list<std::pair<Imm2dTextKey, Imm2dTextLayout>> imm2d_textCache;
+static std::unordered_map<Imm2dTextKey, decltype(imm2d_textCache)::iterator, Imm2dTextKeyHash> imm2d_textCacheIndex;
+
+static const Imm2dTextLayout &imm2d_GetTextLayout(Imm2dGlyphFace &face, const char *text, const char *fontName, int fontPtSize, bool centered)
+{
+    Imm2dTextKey key{ text, fontName, fontPtSize, face.antiAliased, centered };
+
+    const auto found = imm2d_textCacheIndex.find(key);
+    if (found != imm2d_textCacheIndex.end())
+    {
+        imm2d_textCache.splice(imm2d_textCache.begin(), imm2d_textCache, found->second);
+
+        Imm2dTextLayout &layout = found->second->second;
+        if (layout.generation == imm2d_glyphAtlas.generation)
+        {
+            ++imm2d_textCacheStats.hits;
+            return layout;
+        }
+
+        // The atlas started over since this was laid out, so its letters have moved
+        ++imm2d_textCacheStats.misses;
+        layout = imm2d_LayoutString(face, text, centered);
+        return layout;
+    }
+
+    ++imm2d_textCacheStats.misses;
+    if (imm2d_textCache.size() == imm2d_textCacheCapacity)
+    {
+        imm2d_textCacheIndex.erase(imm2d_textCache.back().first);
+        imm2d_textCache.pop_back();
+    }
+
+    imm2d_textCache.emplace_front(key, imm2d_LayoutString(face, text, centered));
+    imm2d_textCacheIndex.emplace(std::move(key), imm2d_textCache.begin());
+    imm2d_textCacheStats.entries = int(imm2d_textCache.size());
+
+    return imm2d_textCache.front().second;
+}
+
+static void imm2d_ClearTextCache()
+{
+    imm2d_textCacheIndex.clear();
+    imm2d_textCache.clear();
+    imm2d_textCacheStats.entries = 0;
+}
+
+static void imm2d_DrawString(int x, int y, const char *text, const char *fontName, int fontPtSize, const Color c, bool centered)
+{
+    if (imm2d_IsPixelFont(fontName))
+    {
+        imm2d_DrawPixelFont(x, y, text, fontPtSize, c, centered);
+        return;
+    }
+
+    Imm2dGlyphFace &face = imm2d_GetGlyphFace(fontName, fontPtSize, imm2d_antiAliased);
+
+    // Really big letters would fill up the atlas after only a few of them
+    if (face.lineHeight > Imm2dGlyphAtlas::PageSize / 4)
+    {
+        imm2d_DrawStringDirect(x, y, text, fontName, fontPtSize, c, centered);
+        return;
+    }
+
+    int left = Width, top = Height, right = 0, bottom = 0;
+
+    const Imm2dTextLayout &layout = imm2d_GetTextLayout(face, text, fontName, fontPtSize, centered);
+    for (const auto &g : layout.glyphs)
+    {
+        const uint8_t *mask = imm2d_glyphAtlas.pages[g.page].data();
+        for (int row = 0; row < g.height; ++row)
+        {
+            int spanX = x + g.left, count = g.width;
+            const int spanY = y + g.top + row;
+            const int skipped = imm2d_ClipSpan(spanX, spanY, count);
+            if (skipped < 0) continue;
+
+            imm2d_BlendMask(imm2d_PixelAt(spanX, spanY), mask + size_t(g.atlasY + row) * Imm2dGlyphAtlas::PageSize + g.atlasX + skipped, size_t(count), c);
+
+            left = std::min(left, spanX);
+            top = std::min(top, spanY);
+            right = std::max(right, spanX + count);
+            bottom = std::max(bottom, spanY + 1);
+        }
+    }
+
+    if (left < right) imm2d_SetDirty(left, top, right, bottom);
+}
+
+static int imm2d_MeasureString(const char *text, const char *fontName, int fontPtSize)
+{
+    if (imm2d_IsPixelFont(fontName)) return imm2d_PixelFontMeasure(text, imm2d_PixelFontScale(fontPtSize));
+
+    Imm2dGlyphFace &face = imm2d_GetGlyphFace(fontName, fontPtSize, imm2d_antiAliased);
+
+    // Big fonts are drawn by GDI+, so GDI+ measures them, too
+    if (face.lineHeight > Imm2dGlyphAtlas::PageSize / 4)
+    {
+        const auto wide = imm2d_ToWide(text);
+        const Gdiplus::StringFormat format;
+        Gdiplus::RectF bounds;
+        imm2d_graphics->MeasureString(wide.c_str(), static_cast<INT>(wide.length()), face.font, Gdiplus::PointF(0, 0), &format, &bounds);
+        return int(std::ceil(bounds.Width));
+    }
+
+    // Text is usually measured so it can be lined up by hand and then drawn normally, so
+    // this shares the cache entry that left-justified DrawString calls use
+    return imm2d_GetTextLayout(face, text, fontName, fontPtSize, false).width;
+}
+
+#endif
+
+// A fast 64-bit hash of some bytes (this is the "XXH64" algorithm with a seed of zero)
+static uint64_t imm2d_Hash(const char *data, size_t length)
+{
+    constexpr uint64_t P1 = 11400714785074694791ULL, P2 = 14029467366897019727ULL, P3 = 1609587929392839161ULL, P4 = 9650029242287828579ULL, P5 = 2870177450012600261ULL;
+
+    const auto rotate = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    const auto read64 = [](const char *p) { uint64_t v; std::memcpy(&v, p, 8); return v; };
+    const auto read32 = [](const char *p) { uint32_t v; std::memcpy(&v, p, 4); return v; };
+    const auto round = [&](uint64_t total, uint64_t input) { return rotate(total + input * P2, 31) * P1; };
+    const auto merge = [&](uint64_t h, uint64_t total) { return (h ^ round(0, total)) * P1 + P4; };
+
+    const char *p = data, *const end = data + length;
+    uint64_t h = P5;
+
+    // Long inputs are mixed 32 bytes at a time into four separate totals
+    if (length >= 32)
+    {
+        uint64_t v1 = P1 + P2, v2 = P2, v3 = 0, v4 = 0 - P1;
+        for (; p + 32 <= end; p += 32)
+        {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+        }
+
+        h = rotate(v1, 1) + rotate(v2, 7) + rotate(v3, 12) + rotate(v4, 18);
+        h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+    }
+
+    h += length;
+    for (; p + 8 <= end; p += 8) h = rotate(h ^ round(0, read64(p)), 27) * P1 + P4;
+    if (p + 4 <= end) { h = rotate(h ^ (read32(p) * P1), 23) * P2 + P3; p += 4; }
+    for (; p < end; ++p) h = rotate(h ^ (uint8_t(*p) * P5), 11) * P1;
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    return h ^ (h >> 32);
+}
+
+//
+// Image decoding
+//
+// .png, .gif, and .bmp files are decoded right here, without any help from the operating
+// system, so images load the same way (and just as quickly) everywhere.  Every decoder
+// treats the file as untrusted: anything that doesn't add up just makes LoadImage fail.
+//
+
+// What the decoders produce: straight (not premultiplied) ARGB pixels, like the screen
+struct Imm2dDecodedImage
+{
+    int width = 0, height = 0;
+
+    // Every animation frame, one after the other (or just the one picture)
+    std::vector<uint32_t> pixels;
+
+    // How long each frame is shown, in hundredths of a second (empty if it isn't animated)
+    std::vector<uint32_t> frameCentiSeconds;
+};
+
+// Keeps a single image from using up all of the computer's memory (even across all of its
+// animation frames), which is also where a broken or malicious file would usually go wrong
+static constexpr size_t imm2d_maxImagePixels = size_t(1) << 26;
+
+static bool imm2d_CheckImageSize(int width, int height, size_t frames = 1)
+{
+    if (width <= 0 || height <= 0 || width > 16384 || height > 16384) return false;
+    return size_t(width) * height * frames <= imm2d_maxImagePixels;
+}
+
+// Decodes the uncompressed 8, 24, and 32-bit .bmp files that most paint programs
+// save (the most common kinds)
+static bool imm2d_DecodeBmp(const std::string &data, Imm2dDecodedImage &image)
+{
+    auto read = [&](size_t offset, int bytes) -> uint32_t {
+        uint32_t v = 0;
+        for (int i = bytes - 1; i >= 0; --i) v = (v << 8) | static_cast<unsigned char>(data[offset + i]);
+        return v;
+    };
+
+    if (data.size() < 54 || data[0] != 'B' || data[1] != 'M') return false;
+
+    const uint32_t dataOffset = read(10, 4);
+    const uint32_t headerSize = read(14, 4);
+    const int width = static_cast<int32_t>(read(18, 4));
+    const int32_t rawHeight = static_cast<int32_t>(read(22, 4));
+    const uint32_t bpp = read(28, 2);
+    const uint32_t compression = read(30, 4);
+
+    // Negative heights mean the rows are stored top-down instead of bottom-up
+    if (rawHeight == INT32_MIN) return false;
+    const int height = rawHeight < 0 ? -rawHeight : rawHeight;
+    if (!imm2d_CheckImageSize(width, height)) return false;
+    if (compression != 0 && !(compression == 3 && bpp == 32)) return false;
+    if (bpp != 8 && bpp != 24 && bpp != 32) return false;
+
+    const size_t stride = ((size_t(width) * bpp + 31) / 32) * 4;
+    if (dataOffset > data.size() || stride * height > data.size() - dataOffset) return false;
+
+    uint32_t colorsUsed = read(46, 4);
+    if (colorsUsed == 0 || colorsUsed > 256) colorsUsed = 256;
+    const size_t paletteOffset = 14 + size_t(headerSize);
+    if (bpp == 8 && paletteOffset + colorsUsed * 4 > data.size()) return false;
+
+    image.width = width;
+    image.height = height;
+    image.pixels.resize(size_t(width) * height);
+    for (int y = 0; y < height; ++y)
+    {
+        const size_t row = dataOffset + stride * (rawHeight < 0 ? y : height - 1 - y);
+        for (int x = 0; x < width; ++x)
+        {
+            uint32_t c = 0;
+            switch (bpp)
+            {
+            case 8:
+            {
+                const uint32_t index = static_cast<unsigned char>(data[row + x]);
+                c = index < colorsUsed ? read(paletteOffset + index * 4, 3) : 0;
+                break;
+            }
+            case 24: c = read(row + x * 3, 3); break;
+            case 32: c = read(row + x * 4, 3); break;
+            }
+
+            image.pixels[size_t(y) * width + x] = 0xFF000000 | c;
+        }
+    }
+
+    return true;
+}
+
+//
+// PNG pixels are compressed with zlib's "deflate" format: a mix of literal bytes and
+// references back to earlier output ("copy 12 bytes from 300 bytes ago"), all written
+// with Huffman codes.  This is the standard decoder for it, with a lookup table for
+// short codes so most symbols are read in a single step.
+//
+
+struct Imm2dHuffman
+{
+    // Codes up to FastBits long are found directly: each entry is (symbol << 4) | length,
+    // with zero meaning "longer than that" (which is handled the slow way)
+    static constexpr int FastBits = 10;
+    uint16_t fast[1 << FastBits];
+
+    // The number of codes of each length, and the symbols in code order ("canonical" form)
+    uint16_t counts[16];
+    uint16_t symbols[288];
+
+    bool build(const uint8_t *lengths, int count)
+    {
+        std::fill(std::begin(counts), std::end(counts), uint16_t(0));
+        for (int i = 0; i < count; ++i) ++counts[lengths[i]];
+        counts[0] = 0;
+
+        // More codes of some length than there's room for means the data is broken
+        int left = 1;
+        uint16_t offsets[16] = {};
+        for (int length = 1; length < 16; ++length)
+        {
+            left = (left << 1) - counts[length];
+            if (left < 0) return false;
+            if (length < 15) offsets[length + 1] = uint16_t(offsets[length] + counts[length]);
+        }
+
+        for (int i = 0; i < count; ++i)
+            if (lengths[i]) symbols[offsets[lengths[i]]++] = uint16_t(i);
+
+        // Codes are stored in the stream starting with their highest bit, but the bits are
+        // read lowest-first, so each short code fills every table entry that starts with it
+        std::fill(std::begin(fast), std::end(fast), uint16_t(0));
+        int code = 0, index = 0;
+        for (int length = 1; length <= FastBits; ++length, code <<= 1)
+        {
+            for (int n = 0; n < counts[length]; ++n, ++code, ++index)
+            {
+                int reversed = 0;
+                for (int bit = 0; bit < length; ++bit) reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+                for (int entry = reversed; entry < (1 << FastBits); entry += 1 << length) fast[entry] = uint16_t((symbols[index] << 4) | length);
+            }
+        }
+
+        return true;
+    }
+};
+
+struct Imm2dInflater
+{
+    const uint8_t *in = nullptr;
+    size_t size = 0, position = 0;
+
+    // Bits waiting to be used (lowest first), and how many zero bytes have been made up
+    // past the end of the input to keep the buffer full
+    uint64_t bits = 0;
+    int bitCount = 0, madeUp = 0;
+
+    std::vector<uint8_t> out;
+    size_t written = 0;
+
+    void refill()
+    {
+        while (bitCount <= 56)
+        {
+            if (position < size) bits |= uint64_t(in[position++]) << bitCount;
+            else ++madeUp;
+            bitCount += 8;
+        }
+    }
+
+    // True once any of the made-up bytes have actually been used
+    bool overran() const { return madeUp * 8 > bitCount; }
+
+    uint32_t take(int count)
+    {
+        if (bitCount < count) refill();
+        const uint32_t v = uint32_t(bits & ((uint64_t(1) << count) - 1));
+        bits >>= count;
+        bitCount -= count;
+        return v;
+    }
+
+    int decode(const Imm2dHuffman &h)
+    {
+        if (bitCount < 15) refill();
+
+        const uint16_t entry = h.fast[bits & ((1 << Imm2dHuffman::FastBits) - 1)];
+        if (entry)
+        {
+            bits >>= entry & 15;
+            bitCount -= entry & 15;
+            return entry >> 4;
+        }
+
+        // The slow way, one bit at a time
+        int code = 0, first = 0, index = 0;
+        for (int length = 1; length < 16; ++length)
+        {
+            code |= int((bits >> (length - 1)) & 1);
+            const int count = h.counts[length];
+            if (code - count < first)
+            {
+                bits >>= length;
+                bitCount -= length;
+                return h.symbols[index + (code - first)];
+            }
+
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+
+        return -1;
+    }
+
+    bool codes(const Imm2dHuffman &literals, const Imm2dHuffman &distances)
+    {
+        static constexpr uint16_t LengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static constexpr uint8_t LengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        static constexpr uint16_t DistanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+        static constexpr uint8_t DistanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+        uint8_t *const o = out.data();
+        while (true)
+        {
+            const int symbol = decode(literals);
+            if (symbol < 0 || overran()) return false;
+
+            if (symbol < 256)
+            {
+                if (written == out.size()) return false;
+                o[written++] = uint8_t(symbol);
+                continue;
+            }
+
+            if (symbol == 256) return true;
+            if (symbol > 285) return false;
+
+            const int length = LengthBase[symbol - 257] + int(take(LengthExtra[symbol - 257]));
+            const int d = decode(distances);
+            if (d < 0 || d > 29 || overran()) return false;
+
+            const size_t distance = DistanceBase[d] + take(DistanceExtra[d]);
+            if (distance > written || size_t(length) > out.size() - written) return false;
+
+            // (These can overlap, which is how runs of the same few bytes are stored)
+            const uint8_t *from = o + written - distance;
+            uint8_t *to = o + written;
+            for (int i = 0; i < length; ++i) to[i] = from[i];
+            written += size_t(length);
+        }
+    }
+
+    bool stored()
+    {
+        // Stored blocks start on a byte boundary
+        take(bitCount & 7);
+
+        const uint32_t length = take(16), check = take(16);
+        if ((length ^ 0xFFFF) != check || length > out.size() - written) return false;
+
+        for (uint32_t i = 0; i < length; ++i) out[written++] = uint8_t(take(8));
+        return !overran();
+    }
+
+    bool fixed()
+    {
+        static const auto tables = [] {
+            uint8_t lengths[288];
+            std::fill(lengths, lengths + 144, uint8_t(8));
+            std::fill(lengths + 144, lengths + 256, uint8_t(9));
+            std::fill(lengths + 256, lengths + 280, uint8_t(7));
+            std::fill(lengths + 280, lengths + 288, uint8_t(8));
+
+            std::pair<Imm2dHuffman, Imm2dHuffman> result;
+            result.first.build(lengths, 288);
+
+            std::fill(lengths, lengths + 30, uint8_t(5));
+            result.second.build(lengths, 30);
+            return result;
+        }();
+
+        return codes(tables.first, tables.second);
+    }
+
+    bool dynamic()
+    {
+        static constexpr uint8_t Order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+        const int literalCount = int(take(5)) + 257, distanceCount = int(take(5)) + 1, codeCount = int(take(4)) + 4;
+        if (literalCount > 286 || distanceCount > 30) return false;
+
+        // First come the lengths of the codes used to send the rest of the lengths
+        uint8_t lengths[288 + 32] = {};
+        for (int i = 0; i < codeCount; ++i) lengths[Order[i]] = uint8_t(take(3));
+
+        Imm2dHuffman lengthCodes;
+        if (!lengthCodes.build(lengths, 19)) return false;
+
+        std::fill(lengths, lengths + 19, uint8_t(0));
+        for (int i = 0; i < literalCount + distanceCount; )
+        {
+            const int symbol = decode(lengthCodes);
+            if (symbol < 0 || overran()) return false;
+
+            if (symbol < 16) { lengths[i++] = uint8_t(symbol); continue; }
+
+            uint8_t value = 0;
+            int repeat = 0;
+            if (symbol == 16)
+            {
+                if (i == 0) return false;
+                value = lengths[i - 1];
+                repeat = 3 + int(take(2));
+            }
+            else if (symbol == 17) repeat = 3 + int(take(3));
+            else repeat = 11 + int(take(7));
+
+            if (i + repeat > literalCount + distanceCount) return false;
+            while (repeat--) lengths[i++] = value;
+        }
+
+        // Without an end-of-block code, there would be no way to stop
+        if (lengths[256] == 0) return false;
+
+        Imm2dHuffman literals, distances;
+        if (!literals.build(lengths, literalCount)) return false;
+        if (!distances.build(lengths + literalCount, distanceCount)) return false;
+
+        return codes(literals, distances);
+    }
+
+    // Fills "out" with exactly expected bytes (anything more or less is a broken file)
+    bool inflate(const uint8_t *zlib, size_t zlibSize, size_t expected)
+    {
+        // The two-byte zlib header: deflate with no preset dictionary
+        if (zlibSize < 2 || (zlib[0] & 15) != 8 || (zlib[1] & 0x20) || ((zlib[0] << 8) | zlib[1]) % 31 != 0) return false;
+
+        in = zlib + 2;
+        size = zlibSize - 2;
+        out.resize(expected);
+
+        bool last = false;
+        while (!last)
+        {
+            last = take(1) != 0;
+
+            bool ok = false;
+            switch (take(2))
+            {
+            case 0: ok = stored(); break;
+            case 1: ok = fixed(); break;
+            case 2: ok = dynamic(); break;
+            }
+
+            if (!ok) return false;
+        }
+
+        return written == expected;
+    }
+};
+
+// Reads a PNG's big-endian numbers
+static uint32_t imm2d_ReadBigEndian(const uint8_t *p) { return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3]; }
+
+// Each row of a PNG is stored as the difference from a guess (based on the pixels to the
+// left and above), which usually compresses better.  This turns them back into pixels.
+static bool imm2d_UnfilterPng(uint8_t *rows, size_t rowBytes, int height, int pixelBytes)
+{
+    const uint8_t *previous = nullptr;
+    for (int y = 0; y < height; ++y)
+    {
+        const uint8_t filter = rows[0];
+        uint8_t *row = rows + 1;
+
+        switch (filter)
+        {
+        case 0: break;
+
+        case 1:
+            for (size_t x = size_t(pixelBytes); x < rowBytes; ++x) row[x] = uint8_t(row[x] + row[x - pixelBytes]);
+            break;
+
+        case 2:
+            if (previous) for (size_t x = 0; x < rowBytes; ++x) row[x] = uint8_t(row[x] + previous[x]);
+            break;
+
+        case 3:
+            for (size_t x = 0; x < rowBytes; ++x)
+            {
+                const int left = x >= size_t(pixelBytes) ? row[x - pixelBytes] : 0, up = previous ? previous[x] : 0;
+                row[x] = uint8_t(row[x] + ((left + up) >> 1));
+            }
+            break;
+
+        case 4:
+            for (size_t x = 0; x < rowBytes; ++x)
+            {
+                const int a = x >= size_t(pixelBytes) ? row[x - pixelBytes] : 0, b = previous ? previous[x] : 0;
+                const int c = (x >= size_t(pixelBytes) && previous) ? previous[x - pixelBytes] : 0;
+
+                // The "Paeth" guess: whichever neighbor is closest to a + b - c
+                const int pa = std::abs(b - c), pb = std::abs(a - c), pc = std::abs(a + b - 2 * c);
+                row[x] = uint8_t(row[x] + ((pa <= pb && pa <= pc) ? a : pb <= pc ? b : c));
+            }
+            break;
+
+        default: return false;
+        }
+
+        previous = row;
+        rows += rowBytes + 1;
+    }
+
+    return true;
+}
+
+static bool imm2d_DecodePng(const std::string &data, Imm2dDecodedImage &image)
+{
+    static constexpr uint8_t Signature[8] = { 137, 'P', 'N', 'G', 13, 10, 26, 10 };
+    if (data.size() < 8 || std::memcmp(data.data(), Signature, 8) != 0) return false;
+
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data.data());
+    int width = 0, height = 0, depth = 0, colorType = -1, interlace = 0;
+
+    uint32_t palette[256];
+    std::fill(std::begin(palette), std::end(palette), 0xFF000000);
+    int paletteSize = 0;
+
+    // Colors (compared before being cut down to 8 bits) that should be see-through
+    bool hasTransparentColor = false;
+    uint16_t transparent[3] = {};
+
+    std::vector<uint8_t> compressed;
+    bool ended = false;
+
+    // The file is a series of "chunks": length, four-letter type, contents, and a checksum
+    for (size_t p = 8; !ended; )
+    {
+        // (Files cut off after their pixels are forgiven, since they can still be shown)
+        if (data.size() - p < 12) break;
+
+        const uint32_t length = imm2d_ReadBigEndian(bytes + p);
+        const uint8_t *type = bytes + p + 4, *chunk = bytes + p + 8;
+        if (length > data.size() - p - 12) break;
+        p += size_t(length) + 12;
+
+        const auto is = [type](const char *name) { return std::memcmp(type, name, 4) == 0; };
+        if (is("IHDR"))
+        {
+            if (length < 13) return false;
+            width = int(std::min<uint32_t>(imm2d_ReadBigEndian(chunk), INT32_MAX));
+            height = int(std::min<uint32_t>(imm2d_ReadBigEndian(chunk + 4), INT32_MAX));
+            depth = chunk[8];
+            colorType = chunk[9];
+            interlace = chunk[12];
+            if (chunk[10] != 0 || chunk[11] != 0 || interlace > 1) return false;
+        }
+        else if (is("PLTE"))
+        {
+            paletteSize = int(std::min<uint32_t>(length / 3, 256));
+            for (int i = 0; i < paletteSize; ++i) palette[i] = 0xFF000000 | (uint32_t(chunk[i * 3]) << 16) | (uint32_t(chunk[i * 3 + 1]) << 8) | chunk[i * 3 + 2];
+        }
+        else if (is("tRNS"))
+        {
+            if (colorType == 3) for (uint32_t i = 0; i < std::min<uint32_t>(length, 256); ++i) palette[i] = (palette[i] & 0xFFFFFF) | (uint32_t(chunk[i]) << 24);
+            else if (colorType == 0 && length >= 2) { hasTransparentColor = true; transparent[0] = uint16_t((chunk[0] << 8) | chunk[1]); }
+            else if (colorType == 2 && length >= 6)
+            {
+                hasTransparentColor = true;
+                for (int i = 0; i < 3; ++i) transparent[i] = uint16_t((chunk[i * 2] << 8) | chunk[i * 2 + 1]);
+            }
+        }
+        else if (is("IDAT")) compressed.insert(compressed.end(), chunk, chunk + length);
+        else if (is("IEND")) ended = true;
+    }
+
+    // Which combinations of color type and bit depth are allowed
+    int channels = 0;
+    switch (colorType)
+    {
+    case 0: channels = 1; if (depth != 1 && depth != 2 && depth != 4 && depth != 8 && depth != 16) return false; break;
+    case 3: channels = 1; if (depth != 1 && depth != 2 && depth != 4 && depth != 8) return false; break;
+    case 2: channels = 3; if (depth != 8 && depth != 16) return false; break;
+    case 4: channels = 2; if (depth != 8 && depth != 16) return false; break;
+    case 6: channels = 4; if (depth != 8 && depth != 16) return false; break;
+    default: return false;
+    }
+
+    if (!imm2d_CheckImageSize(width, height)) return false;
+    if (colorType == 3 && paletteSize == 0) return false;
+
+    const int bitsPerPixel = channels * depth, pixelBytes = std::max(1, bitsPerPixel / 8);
+
+    // Interlaced images are stored as seven smaller images ("passes") that each fill in
+    // every so many pixels, so a partial download can show a blurry version right away
+    struct Pass { int x, y, stepX, stepY; };
+    static constexpr Pass Adam7[7] = { { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 }, { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 } };
+    static constexpr Pass Whole[1] = { { 0, 0, 1, 1 } };
+    const Pass *passes = interlace ? Adam7 : Whole;
+    const int passCount = interlace ? 7 : 1;
+
+    size_t expected = 0;
+    for (int i = 0; i < passCount; ++i)
+    {
+        const int w = (width - passes[i].x + passes[i].stepX - 1) / passes[i].stepX, h = (height - passes[i].y + passes[i].stepY - 1) / passes[i].stepY;
+        if (w > 0 && h > 0) expected += (size_t(w) * bitsPerPixel + 7) / 8 * h + h;
+    }
+
+    Imm2dInflater inflater;
+    if (!inflater.inflate(compressed.data(), compressed.size(), expected)) return false;
+
+    image.width = width;
+    image.height = height;
+    image.pixels.assign(size_t(width) * height, 0);
+
+    uint8_t *rows = inflater.out.data();
+    for (int i = 0; i < passCount; ++i)
+    {
+        const Pass &pass = passes[i];
+        const int w = (width - pass.x + pass.stepX - 1) / pass.stepX, h = (height - pass.y + pass.stepY - 1) / pass.stepY;
+        if (w <= 0 || h <= 0) continue;
+
+        const size_t rowBytes = (size_t(w) * bitsPerPixel + 7) / 8;
+        if (!imm2d_UnfilterPng(rows, rowBytes, h, pixelBytes)) return false;
+
+        for (int y = 0; y < h; ++y)
+        {
+            const uint8_t *row = rows + y * (rowBytes + 1) + 1;
+            uint32_t *out = &image.pixels[size_t(pass.y + y * pass.stepY) * width + pass.x];
+
+            // One channel of one pixel, along with its full 16-bit value (for tRNS)
+            const auto sample = [&](int x, int channel, uint16_t &full) -> uint32_t {
+                if (depth == 8) return full = row[x * channels + channel];
+                if (depth == 16) { full = uint16_t((row[(x * channels + channel) * 2] << 8) | row[(x * channels + channel) * 2 + 1]); return full >> 8; }
+
+                const int bit = x * depth;
+                full = uint16_t((row[bit >> 3] >> (8 - depth - (bit & 7))) & ((1 << depth) - 1));
+                return colorType == 3 ? full : full * 255 / ((1 << depth) - 1);
+            };
+
+            for (int x = 0; x < w; ++x)
+            {
+                uint16_t r16 = 0, g16 = 0, b16 = 0, a16 = 0;
+                uint32_t c = 0;
+                switch (colorType)
+                {
+                case 0:
+                {
+                    const uint32_t v = sample(x, 0, r16);
+                    c = (hasTransparentColor && r16 == transparent[0] ? 0 : 0xFF000000) | (v * 0x010101);
+                    break;
+                }
+                case 2:
+                {
+                    const uint32_t r = sample(x, 0, r16), g = sample(x, 1, g16), b = sample(x, 2, b16);
+                    const bool clear = hasTransparentColor && r16 == transparent[0] && g16 == transparent[1] && b16 == transparent[2];
+                    c = (clear ? 0 : 0xFF000000) | (r << 16) | (g << 8) | b;
+                    break;
+                }
+                case 3: c = palette[sample(x, 0, r16)]; break;
+                case 4: c = (sample(x, 1, a16) << 24) | (sample(x, 0, r16) * 0x010101); break;
+                case 6: c = (sample(x, 3, a16) << 24) | (sample(x, 0, r16) << 16) | (sample(x, 1, g16) << 8) | sample(x, 2, b16); break;
+                }
+
+                out[size_t(x) * pass.stepX] = c;
+            }
+        }
+
+        rows += (rowBytes + 1) * h;
+    }
+
+    return true;
+}
+
+// GIF pixels are compressed with "LZW": each code stands for a string of palette indexes
+// that is one longer than some earlier code's string, so the dictionary builds itself.
+static bool imm2d_DecodeLzw(const uint8_t *in, size_t size, int minimumSize, uint8_t *out, size_t count)
+{
+    if (minimumSize < 2 || minimumSize > 8) return false;
+
+    const int clear = 1 << minimumSize, end = clear + 1;
+    uint16_t prefix[4096];
+    uint8_t suffix[4096], first[4096], stack[4096];
+    for (int i = 0; i < clear; ++i) { prefix[i] = 0xFFFF; suffix[i] = first[i] = uint8_t(i); }
+
+    int codeSize = minimumSize + 1, next = end + 1, previous = -1;
+    uint32_t bits = 0;
+    int bitCount = 0;
+    size_t written = 0, p = 0;
+
+    while (written < count)
+    {
+        while (bitCount < codeSize)
+        {
+            // Running out early happens with some encoders; the rest of the frame stays transparent
+            if (p == size) return true;
+            bits |= uint32_t(in[p++]) << bitCount;
+            bitCount += 8;
+        }
+
+        const int code = int(bits & ((1u << codeSize) - 1));
+        bits >>= codeSize;
+        bitCount -= codeSize;
+
+        if (code == clear) { codeSize = minimumSize + 1; next = end + 1; previous = -1; continue; }
+        if (code == end) return true;
+
+        if (previous < 0)
+        {
+            if (code >= clear) return false;
+            out[written++] = uint8_t(code);
+            previous = code;
+            continue;
+        }
+
+        // A code that's about to be added is the previous string plus its own first index
+        int current = code;
+        int depth = 0;
+        if (code >= next)
+        {
+            if (code > next) return false;
+            stack[depth++] = first[previous];
+            current = previous;
+        }
+
+        while (current >= clear)
+        {
+            stack[depth++] = suffix[current];
+            current = prefix[current];
+        }
+        stack[depth++] = uint8_t(current);
+
+        while (depth > 0 && written < count) out[written++] = stack[--depth];
+
+        if (next < 4096)
+        {
+            prefix[next] = uint16_t(previous);
+            suffix[next] = uint8_t(current);
+            first[next] = first[previous];
+            ++next;
+
+            if (next == (1 << codeSize) && codeSize < 12) ++codeSize;
+        }
+
+        previous = code;
+    }
+
+    return true;
+}
+
+static bool imm2d_DecodeGif(const std::string &data, Imm2dDecodedImage &image)
+{
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data.data());
+    const size_t size = data.size();
+    if (size < 13 || (std::memcmp(bytes, "GIF87a", 6) != 0 && std::memcmp(bytes, "GIF89a", 6) != 0)) return false;
+
+    const auto read16 = [bytes](size_t p) { return int(bytes[p] | (bytes[p + 1] << 8)); };
+
+    const int width = read16(6), height = read16(8);
+    if (!imm2d_CheckImageSize(width, height)) return false;
+
+    size_t p = 13;
+    uint32_t globalColors[256] = {};
+    int globalCount = 0;
+    if (bytes[10] & 0x80)
+    {
+        globalCount = 2 << (bytes[10] & 7);
+        if (size - p < size_t(globalCount) * 3) return false;
+        for (int i = 0; i < globalCount; ++i) globalColors[i] = 0xFF000000 | (uint32_t(bytes[p + i * 3]) << 16) | (uint32_t(bytes[p + i * 3 + 1]) << 8) | bytes[p + i * 3 + 2];
+        p += size_t(globalCount) * 3;
+    }
+
+    // Each frame is drawn over the last one, so the whole picture is kept as it builds up
+    std::vector<uint32_t> canvas(size_t(width) * height, 0), saved;
+    std::vector<uint8_t> indexes, compressed;
+
+    // Settings from the "graphic control" block that comes before a frame
+    int delay = 0, disposal = 0, transparentIndex = -1;
+
+    image.width = width;
+    image.height = height;
+    image.pixels.clear();
+    image.frameCentiSeconds.clear();
+
+    // Blocks of extra data are split into pieces of up to 255 bytes
+    const auto readSubBlocks = [&](std::vector<uint8_t> *into) {
+        while (p < size)
+        {
+            const size_t length = bytes[p++];
+            if (length == 0) return true;
+            if (size - p < length) return false;
+            if (into) into->insert(into->end(), bytes + p, bytes + p + length);
+            p += length;
+        }
+        return false;
+    };
+
+    while (p < size)
+    {
+        const uint8_t kind = bytes[p++];
+        if (kind == 0x3B) break;
+
+        if (kind == 0x21)
+        {
+            if (p == size) return false;
+            const uint8_t label = bytes[p++];
+            if (label == 0xF9 && size - p >= 6 && bytes[p] >= 4)
+            {
+                const uint8_t flags = bytes[p + 1];
+                disposal = (flags >> 2) & 7;
+                delay = read16(p + 2);
+                transparentIndex = (flags & 1) ? bytes[p + 4] : -1;
+            }
+
+            if (!readSubBlocks(nullptr)) return false;
+            continue;
+        }
+
+        if (kind != 0x2C) return false;
+
+        // A frame: where it goes, its own colors (if it has any), and its compressed pixels
+        if (size - p < 10) return false;
+        const int left = read16(p), top = read16(p + 2), w = read16(p + 4), h = read16(p + 6);
+        const uint8_t flags = bytes[p + 8];
+        p += 9;
+
+        const uint32_t *colors = globalColors;
+        int colorCount = globalCount;
+        uint32_t localColors[256] = {};
+        if (flags & 0x80)
+        {
+            colorCount = 2 << (flags & 7);
+            if (size - p < size_t(colorCount) * 3) return false;
+            for (int i = 0; i < colorCount; ++i) localColors[i] = 0xFF000000 | (uint32_t(bytes[p + i * 3]) << 16) | (uint32_t(bytes[p + i * 3 + 1]) << 8) | bytes[p + i * 3 + 2];
+            p += size_t(colorCount) * 3;
+            colors = localColors;
+        }
+
+        if (p == size) return false;
+        const int minimumSize = bytes[p++];
+
+        compressed.clear();
+        if (!readSubBlocks(&compressed)) return false;
+
+        const size_t frames = image.frameCentiSeconds.size() + 1;
+        if (!imm2d_CheckImageSize(width, height, frames)) return false;
+
+        indexes.assign(size_t(w) * h, uint8_t(transparentIndex >= 0 ? transparentIndex : 0));
+        if (!indexes.empty() && !imm2d_DecodeLzw(compressed.data(), compressed.size(), minimumSize, indexes.data(), indexes.size())) return false;
+
+        if (disposal == 3) saved = canvas;
+
+        // Interlaced frames store every 8th row, then the 4th rows in between, and so on
+        const bool interlaced = (flags & 0x40) != 0;
+        int row = 0, pass = 0;
+        static constexpr int PassStart[4] = { 0, 4, 2, 1 }, PassStep[4] = { 8, 8, 4, 2 };
+        for (int y = 0; y < h; ++y)
+        {
+            const int canvasY = top + (interlaced ? row : y);
+            if (interlaced)
+            {
+                row += PassStep[pass];
+                while (pass < 3 && row >= h) row = PassStart[++pass];
+            }
+
+            if (canvasY >= height) continue;
+            for (int x = 0; x < w && left + x < width; ++x)
+            {
+                const int index = indexes[size_t(y) * w + x];
+                if (index == transparentIndex) continue;
+                canvas[size_t(canvasY) * width + left + x] = index < colorCount ? colors[index] : 0;
+            }
+        }
+
+        image.pixels.insert(image.pixels.end(), canvas.begin(), canvas.end());
+        image.frameCentiSeconds.push_back(uint32_t(delay));
+
+        // What happens to this frame before the next one is drawn over it
+        if (disposal == 2)
+        {
+            for (int y = top; y < std::min(height, top + h); ++y)
+                std::fill(canvas.begin() + size_t(y) * width + std::min(left, width), canvas.begin() + size_t(y) * width + std::min(left + w, width), 0u);
+        }
+        else if (disposal == 3) canvas.swap(saved);
+
+        delay = disposal = 0;
+        transparentIndex = -1;
+    }
+
+    return !image.frameCentiSeconds.empty();
+}
+
+// Tries each of the built-in decoders (each of which checks for its own file signature)
+static bool imm2d_DecodeImage(const std::string &data, Imm2dDecodedImage &image)
+{
+    for (const auto decoder : { imm2d_DecodePng, imm2d_DecodeGif, imm2d_DecodeBmp })
+    {
+        image = Imm2dDecodedImage();
+        if (decoder(data, image)) return true;
+    }
+
+    return false;
+}
+
+// Returns the image that was already loaded (or is still loading) with this name.  If there
+// isn't one, an empty image is added (reusing an unloaded handle if there is one) and
+// remembered under the name, and "added" is set so the caller knows it is their job to load
+// it.  (Doing both under one lock means two threads asking for the same name at once still
+// get the same Image.)
+static Image imm2d_FindOrAddImage(const char *name, uint64_t nameHash, bool &added, uint32_t &generation)
+{
+    std::lock_guard<std::mutex> lock(imm2d_mediaLock);
+
+    added = false;
+    const auto matches = imm2d_imagesByName.equal_range(nameHash);
+    for (auto found = matches.first; found != matches.second; ++found)
+    {
+        if (imm2d_imageNames[found->second] != name) continue;
+
+        ++imm2d_imageCacheStats.hits;
+        generation = imm2d_imageGenerations[found->second];
+        return found->second;
+    }
+
+    ++imm2d_imageCacheStats.misses;
+    added = true;
+
+    Image result;
+    if (!imm2d_freeImages.empty())
+    {
+        result = imm2d_freeImages.back();
+        imm2d_freeImages.pop_back();
+    }
+    else
+    {
+        result = static_cast<Image>(imm2d_images.size());
+        imm2d_imageSizes.emplace_back();
+        imm2d_images.emplace_back();
+        imm2d_imageFrameCumulativeCentiSeconds.emplace_back();
+        imm2d_imageFrameSumMs.emplace_back();
+        imm2d_imageStates.emplace_back();
+        imm2d_imageNames.emplace_back();
+        imm2d_imageLastDrawn.emplace_back();
+        imm2d_imageGenerations.emplace_back();
+    }
+
+    imm2d_imageStates[result] = Imm2dImageState::Loading;
+    imm2d_imageNames[result] = name;
+    imm2d_imageLastDrawn[result] = imm2d_imageClock;
+
+    imm2d_imagesByName.emplace(nameHash, result);
+    imm2d_imageCacheStats.entries = static_cast<int>(imm2d_imagesByName.size());
+    generation = imm2d_imageGenerations[result];
+    return result;
+}
+
+// Only called while mediaLock is held.  Forgets everything about an image (including its
+// name, so asking for it again loads it again) and puts its handle on the free list.
+static void imm2d_ReleaseImage(Image i)
+{
+    auto &name = imm2d_imageNames[i];
+    const auto matches = imm2d_imagesByName.equal_range(imm2d_Hash(name.data(), name.size()));
+    for (auto found = matches.first; found != matches.second; ++found)
+    {
+        if (found->second == i) { imm2d_imagesByName.erase(found); break; }
+    }
+    imm2d_imageCacheStats.entries = static_cast<int>(imm2d_imagesByName.size());
+
+    imm2d_imageMemoryUsed -= static_cast<long long>(imm2d_images[i].size() * sizeof(uint32_t));
+    std::vector<uint32_t>().swap(imm2d_images[i]);
+    std::vector<uint32_t>().swap(imm2d_imageFrameCumulativeCentiSeconds[i]);
+    std::string().swap(name);
+    imm2d_imageSizes[i] = std::pair<int, int>(0, 0);
+    imm2d_imageFrameSumMs[i] = 0;
+
+    imm2d_imageStates[i] = Imm2dImageState::Unloaded;
+    ++imm2d_imageGenerations[i];
+    imm2d_freeImages.push_back(i);
+}
+
+// Only called while mediaLock is held.  Lets go of the least recently drawn images until
+// we're back under the budget (or there's nothing left that can be let go).  The "keep"
+// image is never chosen, so one that just finished loading is always there to be drawn,
+// even if it's bigger than the whole budget by itself.
+static void imm2d_TrimImages(Image keep = InvalidImage)
+{
+    while (imm2d_imageMemoryBudget > 0 && imm2d_imageMemoryUsed > imm2d_imageMemoryBudget)
+    {
+        Image oldest = InvalidImage;
+        for (size_t k = 0; k < imm2d_images.size(); ++k)
+        {
+            if (imm2d_imageStates[k] != Imm2dImageState::Loaded || imm2d_images[k].empty() || static_cast<Image>(k) == keep) continue;
+            if (oldest == InvalidImage || imm2d_imageLastDrawn[k] < imm2d_imageLastDrawn[oldest]) oldest = static_cast<Image>(k);
+        }
+        if (oldest == InvalidImage) return;
+
+        imm2d_imageMemoryUsed -= static_cast<long long>(imm2d_images[oldest].size() * sizeof(uint32_t));
+        std::vector<uint32_t>().swap(imm2d_images[oldest]);
+        imm2d_imageStates[oldest] = Imm2dImageState::Evicted;
+    }
+}
+
+// Fills in an image added by imm2d_FindOrAddImage (along with its animation timing, which is kept
+// as a running total so DrawImage can search it) and wakes anyone waiting for it.  If it couldn't
+// be loaded, its handle is released, so asking for the same name again tries again.
+//
+// An image that was let go is filled back in the same way, size and all: its file may have
+// been changed in the meantime, and drawing goes by the size stored here.
+static void imm2d_FinishImage(Image i, bool reload, bool loaded, Imm2dDecodedImage &&image)
+{
+    std::lock_guard<std::mutex> lock(imm2d_mediaLock);
+
+    // Shutting down may have already cleared everything away
+    if (imm2d_imageStates.size() <= static_cast<size_t>(i)) return;
+
+    if (loaded)
+    {
+        imm2d_images[i] = std::move(image.pixels);
+        imm2d_imageMemoryUsed += static_cast<long long>(imm2d_images[i].size() * sizeof(uint32_t));
+
+        imm2d_imageSizes[i] = std::pair<int, int>(image.width, image.height);
+
+        // TODO: What do "infinite"-length frames at the end of a GIF look like?
+        // TODO: What does the loop count look like?  Is that how we detect infinite loops?
+        auto &cumulative = imm2d_imageFrameCumulativeCentiSeconds[i];
+        cumulative.clear();
+
+        uint32_t sum = 0;
+        for (const uint32_t centiSeconds : image.frameCentiSeconds)
+        {
+            sum += centiSeconds;
+            cumulative.push_back(sum);
+        }
+        imm2d_imageFrameSumMs[i] = sum * 10;
+    }
+    else
+    {
+        // If a file that was let go has since been moved or changed, it stays let go
+        // (so the next draw tries again) instead of looking loaded with no pixels
+        if (reload) imm2d_imageStates[i] = Imm2dImageState::Evicted;
+        else imm2d_ReleaseImage(i);
+
+        imm2d_imageLoaded.notify_all();
+        return;
+    }
+
+    // Something that was just loaded is about to be drawn, so it counts as the most recent
+    imm2d_imageLastDrawn[i] = ++imm2d_imageClock;
+    imm2d_imageStates[i] = Imm2dImageState::Loaded;
+    imm2d_TrimImages(i);
+    imm2d_imageLoaded.notify_all();
+}
+
+// The 6-bit value of each Base64 character, or -1 for anything else
+struct Imm2dBase64Table
+{
+    int8_t value[256];
+
+    constexpr Imm2dBase64Table() : value()
+    {
+        for (int i = 0; i < 256; i++) value[i] = -1;
+        for (int i = 0; i < 64; i++) value[(unsigned char)"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"[i]] = int8_t(i);
+    }
+};
+
+static std::string imm2d_DecodeBase64(const char *base64)
+{
+    static constexpr Imm2dBase64Table T{};
+
+    // Every four characters become three bytes, so we know how big the result can get
+    // before we start and can write straight into it instead of growing it a byte at a time
+    const size_t length = std::strlen(base64);
+    std::string decoded(length / 4 * 3 + 4, '\0');
+    const uint8_t *in = reinterpret_cast<const uint8_t *>(base64);
+    uint8_t *out = reinterpret_cast<uint8_t *>(&decoded[0]);
+    size_t i = 0, o = 0;
+
+    // The vector loops only handle the plain stretch of characters in the middle.  As soon as
+    // they see anything else (padding, the end, or something that isn't Base64), they stop
+    // and leave the rest to the one-at-a-time loop below, which knows what to do about it.
+#if defined(IMM2D_SSE2)
+    const auto inRange = [](__m128i c, char lo, char hi)
+    {
+        return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(char(lo - 1))), _mm_cmplt_epi8(c, _mm_set1_epi8(char(hi + 1))));
+    };
+
+    for (; i + 16 <= length; i += 16, o += 12)
+    {
+        // Bytes above 127 are negative to these signed compares, so they never land in a range
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        const __m128i upper = inRange(c, 'A', 'Z');
+        const __m128i lower = inRange(c, 'a', 'z');
+        const __m128i digit = inRange(c, '0', '9');
+        const __m128i plus = _mm_cmpeq_epi8(c, _mm_set1_epi8('+'));
+        const __m128i slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+
+        const __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(_mm_or_si128(digit, plus), slash));
+        if (_mm_movemask_epi8(valid) != 0xFFFF) break;
+
+        // Each range of characters is a fixed distance away from its 6-bit value
+        __m128i v = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+        v = _mm_or_si128(v, _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+        v = _mm_or_si128(v, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+        v = _mm_or_si128(v, _mm_and_si128(plus, _mm_set1_epi8(62 - '+')));
+        v = _mm_or_si128(v, _mm_and_si128(slash, _mm_set1_epi8(63 - '/')));
+        v = _mm_add_epi8(c, v);
+
+        // Squeeze each group of four 6-bit values into the low 24 bits of its 32-bit lane...
+        v = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0x00FF)), 6), _mm_srli_epi16(v, 8));
+        v = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(v, _mm_set1_epi32(0xFFFF)), 12), _mm_srli_epi32(v, 16));
+
+        // ...then put those three bytes first, in order, so each lane can be written out whole.
+        // The zero left in the fourth byte is overwritten by the next lane (or trimmed at the end).
+        v = _mm_slli_epi32(v, 8);
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+
+        alignas(16) uint32_t lanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i *>(lanes), v);
+        for (int lane = 0; lane < 4; lane++) std::memcpy(out + o + lane * 3, &lanes[lane], 4);
+    }
+#elif defined(IMM2D_NEON)
+    const auto inRange = [](uint8x16_t c, uint8_t lo, uint8_t hi) { return vandq_u8(vcgeq_u8(c, vdupq_n_u8(lo)), vcleq_u8(c, vdupq_n_u8(hi))); };
+    const auto translate = [&inRange](uint8x16_t c, uint8x16_t &valid)
+    {
+        const uint8x16_t upper = inRange(c, 'A', 'Z');
+        const uint8x16_t lower = inRange(c, 'a', 'z');
+        const uint8x16_t digit = inRange(c, '0', '9');
+        const uint8x16_t plus = vceqq_u8(c, vdupq_n_u8('+'));
+        const uint8x16_t slash = vceqq_u8(c, vdupq_n_u8('/'));
+        valid = vandq_u8(valid, vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(vorrq_u8(digit, plus), slash)));
+
+        uint8x16_t v = vandq_u8(upper, vdupq_n_u8(uint8_t(-'A')));
+        v = vorrq_u8(v, vandq_u8(lower, vdupq_n_u8(uint8_t(26 - 'a'))));
+        v = vorrq_u8(v, vandq_u8(digit, vdupq_n_u8(uint8_t(52 - '0'))));
+        v = vorrq_u8(v, vandq_u8(plus, vdupq_n_u8(uint8_t(62 - '+'))));
+        v = vorrq_u8(v, vandq_u8(slash, vdupq_n_u8(uint8_t(63 - '/'))));
+        return vaddq_u8(c, v);
+    };
+
+    for (; i + 64 <= length; i += 64, o += 48)
+    {
+        // The interleaving loads and stores split the characters (and put the bytes back together) for us
+        const uint8x16x4_t c = vld4q_u8(in + i);
+        uint8x16_t valid = vdupq_n_u8(0xFF);
+        const uint8x16_t a = translate(c.val[0], valid), b = translate(c.val[1], valid);
+        const uint8x16_t d = translate(c.val[2], valid), e = translate(c.val[3], valid);
+
+        const uint64x2_t all = vreinterpretq_u64_u8(valid);
+        if ((vgetq_lane_u64(all, 0) & vgetq_lane_u64(all, 1)) != ~uint64_t(0)) break;
+
+        uint8x16x3_t bytes;
+        bytes.val[0] = vorrq_u8(vshlq_n_u8(a, 2), vshrq_n_u8(b, 4));
+        bytes.val[1] = vorrq_u8(vshlq_n_u8(b, 4), vshrq_n_u8(d, 2));
+        bytes.val[2] = vorrq_u8(vshlq_n_u8(d, 6), e);
+        vst3q_u8(out + o, bytes);
+    }
+#endif
+
+    // Base64 decoding snippet adapted from https://stackoverflow.com/a/34571089
+    unsigned int val = 0;
+    int valb = -8;
+    for (; i < length; i++)
+    {
+        const int lookup = T.value[in[i]];
+        if (lookup == -1)
+        {
+            // Unless this was padding, invalid data means this wasn't Base64 to begin with
+            if (in[i] != '=') o = 0;
+            break;
+        }
+
+        val = (val << 6) + lookup, valb += 6;
+        if (valb >= 0) { out[o++] = uint8_t((val >> valb) & 0xFF); valb -= 8; }
+    }
+
+    decoded.resize(o);
+    return decoded;
+}
+
+// Are we being a bad neighbor?  What's the likelihood that the user wants to use the
+// Win32 API version of LoadImage in the same compilation unit as our implementation?
+#ifdef LoadImage
+#undef LoadImage
+#endif
+
+#ifndef IMM2D_HEADLESS
+
+Gdiplus::Bitmap *imm2d_CheckedLoad(Gdiplus::Bitmap *b)
+{
+    // It's not enough to try and load a GDI+ bitmap.  It can return
+    // a valid pointer even when it wasn't able to load anything. You
+    // have to check the image status, too.  So we pass all of our
+    // load calls through this double-checker.
+
+    if (!b || b->GetLastStatus() == Gdiplus::Ok) return b;
+
+    delete b;
+    return nullptr;
+}
+
+// Finds an image embedded in the .exe (see the Game example's .rc file)
+static bool imm2d_ReadResource(const char *resourceName, std::string &contents)
+{
+    const HRSRC id = FindResourceA(nullptr, resourceName, "IMAGES");
+    if (!id) return false;
+
+    const auto size = SizeofResource(nullptr, id);
+    if (!size) return false;
+
+    const auto resource = LoadResource(nullptr, id);
+    if (!resource) return false;
+
+    const void *bytes = LockResource(resource);
+    if (bytes) contents.assign(static_cast<const char *>(bytes), size);
+
+    FreeResource(resource);
+    return bytes != nullptr;
+}
+
+// GDI+ can still decode the formats that aren't built in (like .jpg and .tif)
+static bool imm2d_DecodeGdiplus(const std::string &contents, Imm2dDecodedImage &image)
+{
+    IStream *stream = SHCreateMemStream(reinterpret_cast<const BYTE *>(contents.data()), static_cast<UINT>(contents.size()));
+    if (!stream) return false;
+
+    const std::unique_ptr<Gdiplus::Bitmap> bitmap(imm2d_CheckedLoad(Gdiplus::Bitmap::FromStream(stream)));
+    stream->Release();
+    if (!bitmap) return false;
+
+    const int width = static_cast<int>(bitmap->GetWidth()), height = static_cast<int>(bitmap->GetHeight());
+    const UINT frameCount = bitmap->GetFrameCount(&Gdiplus::FrameDimensionTime);
+    if (!imm2d_CheckImageSize(width, height, std::max(1U, frameCount))) return false;
+
+    image = Imm2dDecodedImage();
+
+    // Asking GDI+ for a different animation frame decodes it all over again, so every
+    // frame is decoded once, right now, and GDI+'s copy of the image is thrown away
+    const size_t framePixels = size_t(width) * height;
+    image.width = width;
+    image.height = height;
+    image.pixels.resize(framePixels * std::max(1U, frameCount));
+    for (UINT frame = 0; frame < std::max(1U, frameCount); ++frame)
+    {
+        if (frameCount > 0) bitmap->SelectActiveFrame(&Gdiplus::FrameDimensionTime, frame);
+
+        Gdiplus::BitmapData data;
+        Gdiplus::Rect all(0, 0, width, height);
+        if (bitmap->LockBits(&all, Gdiplus::ImageLockModeRead, PixelFormat32bppARGB, &data) != Gdiplus::Ok) return false;
+
+        for (int y = 0; y < height; ++y)
+            std::memcpy(&image.pixels[frame * framePixels + size_t(y) * width], static_cast<const uint8_t *>(data.Scan0) + ptrdiff_t(y) * data.Stride, size_t(width) * sizeof(uint32_t));
+
+        bitmap->UnlockBits(&data);
+    }
+
+    if (frameCount > 0)
+    {
+        // GDI+ follows the usual Win32 convention of making you request the size of
+        // the thing first, then having you provide a big enough buffer to fill it.
+        // In this case, "it" is the list of "centi"-second delay between frames.
+        const UINT bufferSize = bitmap->GetPropertyItemSize(PropertyTagFrameDelay);
+        auto itemBuffer = std::make_unique<uint8_t[]>(std::max<UINT>(bufferSize, sizeof(Gdiplus::PropertyItem)));
+
+        auto *item = reinterpret_cast<Gdiplus::PropertyItem *>(itemBuffer.get());
+        const bool hasDelays = bufferSize > 0 && bitmap->GetPropertyItem(PropertyTagFrameDelay, bufferSize, item) == Gdiplus::Ok;
+        const auto *frameCentiSeconds = hasDelays ? reinterpret_cast<long*>(item->value) : nullptr;
+
+        for (size_t i = 0; i < frameCount; ++i) image.frameCentiSeconds.push_back(frameCentiSeconds ? static_cast<uint32_t>(frameCentiSeconds[i]) : 0);
+    }
+
+    return true;
+}
+
+#else
+
+//
+// Headless implementation
+//
+// Without GDI+, everything is drawn directly into our own pixel arrays using
+// the software rasterizers above (and a few more below).
+//
+
+// Just enough of the PNG format to save a screenshot: the pixels are
+// stored uncompressed (using "stored" zlib blocks) in a single IDAT chunk.
+static bool imm2d_WritePng(const char *path, const std::vector<uint32_t> &pixels, int width, int height)
+{
+    static const auto crcTable = []{
+        std::vector<uint32_t> table(256);
+        for (uint32_t n = 0; n < 256; ++n)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        return table;
+    }();
+
+    auto put32 = [](std::string &s, uint32_t v) { for (int shift = 24; shift >= 0; shift -= 8) s.push_back(char((v >> shift) & 0xFF)); };
+
+    std::string png("\x89PNG\r\n\x1A\n", 8);
+    auto chunk = [&](const char *type, const std::string &data) {
+        put32(png, static_cast<uint32_t>(data.size()));
+        const std::string body = std::string(type, 4) + data;
+        png += body;
+
+        uint32_t crc = 0xFFFFFFFFU;
+        for (unsigned char b : body) crc = crcTable[(crc ^ b) & 0xFF] ^ (crc >> 8);
+        put32(png, crc ^ 0xFFFFFFFFU);
+    };
+
+    std::string header;
+    put32(header, width);
+    put32(header, height);
+    header += std::string("\x08\x06\x00\x00\x00", 5);
+    chunk("IHDR", header);
+
+    // Each row is a "no filter" byte followed by that row in RGBA order
+    std::string raw;
+    raw.reserve(size_t(height) * (size_t(width) * 4 + 1));
+    for (int y = 0; y < height; ++y)
+    {
+        raw.push_back(0);
+        for (int x = 0; x < width; ++x)
+        {
+            const uint32_t c = pixels[size_t(y) * width + x];
+            for (int shift : { 16, 8, 0, 24 }) raw.push_back(char((c >> shift) & 0xFF));
+        }
+    }
+
+    std::string zlib("\x78\x01", 2);
+    for (size_t offset = 0; offset < raw.size() || offset == 0; offset += 0xFFFF)
+    {
+        const size_t len = std::min<size_t>(0xFFFF, raw.size() - offset);
+        zlib.push_back(offset + len >= raw.size() ? 1 : 0);
+        for (uint32_t v : { uint32_t(len), uint32_t(~len & 0xFFFF) }) { zlib.push_back(char(v & 0xFF)); zlib.push_back(char(v >> 8)); }
+        zlib.append(raw, offset, len);
+        if (len == 0) break;
+    }
+
+    uint32_t a = 1, b = 0;
+    for (unsigned char c : raw) { a = (a + c) % 65521; b = (b + a) % 65521; }
+    put32(zlib, (b << 16) | a);
+
+    chunk("IDAT", zlib);
+    chunk("IEND", std::string());
+
+    FILE *f = std::fopen(path, "wb");
+    if (!f) return false;
+
+    const bool written = std::fwrite(png.data(), 1, png.size(), f) == png.size();
+    std::fclose(f);
+    return written;
+}
+
+void SaveImage(unsigned int suffix)
+{
+    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+    if (imm2d_pixels.empty()) return;
+
+    // There's no desktop on a server, so this goes in the current directory
+    std::string path = "image";
+    if (suffix > 0) path += "_" + std::to_string(suffix);
+    path += ".png";
+
+    imm2d_WritePng(path.c_str(), imm2d_pixels, Width, Height);
+}
+
+// Without GDI+ there's no text to smooth, so this only changes how shapes are drawn
+static void imm2d_setAntiAliasing(bool enabled)
+{
+    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+    imm2d_antiAliased = enabled;
+}
+
+void UseAntiAliasing() { imm2d_setAntiAliasing(true); }
+void StopAntiAliasing() { imm2d_setAntiAliasing(false); }
+
+// The other fonts come from GDI+, so without it all text uses the built-in font
+static void imm2d_DrawString(int x, int y, const char *text, const char *, int fontPtSize, const Color c, bool centered)
+{
+    imm2d_DrawPixelFont(x, y, text, fontPtSize, c, centered);
+}
+
+static int imm2d_MeasureString(const char *text, const char *, int fontPtSize)
+{
+    return imm2d_PixelFontMeasure(text, imm2d_PixelFontScale(fontPtSize));
+}
+
+#endif
+
+static bool imm2d_ReadFile(const char *path, std::string &contents)
+{
+#ifdef IMM2D_HEADLESS
+    FILE *f = std::fopen(path, "rb");
+#else
+    // (Windows only understands UTF-8 filenames in their "wide" form)
+    FILE *f = _wfopen(imm2d_ToWide(path).c_str(), L"rb");
+#endif
+    if (!f) return false;
+
+    char buffer[4096];
+    size_t count;
+    while ((count = std::fread(buffer, 1, sizeof(buffer), f)) > 0) contents.append(buffer, count);
+
+    std::fclose(f);
+    return true;
+}
+
+// Tries each of the places LoadImage looks, in order.  This doesn't touch any shared
+// state, so the loader threads can all be doing it at the same time.
+static bool imm2d_LoadImageData(const char *name, Imm2dDecodedImage &image)
+{
+    const auto decode = [&image](const std::string &contents) {
+        if (contents.empty()) return false;
+        if (imm2d_DecodeImage(contents, image)) return true;
+#ifndef IMM2D_HEADLESS
+        if (imm2d_DecodeGdiplus(contents, image)) return true;
+#endif
+        return false;
+    };
+
+    // Try the Base64 case from the outset (which fails almost immediately
+    // if the string being passed in isn't actually Base64 data)
+    if (decode(imm2d_DecodeBase64(name))) return true;
+
+    std::string contents;
+#ifndef IMM2D_HEADLESS
+    if (imm2d_ReadResource(name, contents) && decode(contents)) return true;
+#endif
+
+    // TODO: Work much harder to find the file!
+    contents.clear();
+    return imm2d_ReadFile(name, contents) && decode(contents);
+}
+
+
+//
+// Image loader threads
+//
+// All image loading (even for plain LoadImage) happens on these, so the drawing
+// thread never holds bitmapLock while a file is being decoded, and LoadImages can
+// spread a long list across every core.  They're started the first time they're
+// needed and stopped (after finishing whatever they're in the middle of) before
+// the window goes away, so nothing is decoding while GDI+ is being shut down.
+//
+
+struct Imm2dLoadJob { Image image; std::string name; bool reload; };
+
+static std::mutex imm2d_loaderLock;
+static std::condition_variable imm2d_loaderWake;
+static std::deque<Imm2dLoadJob> imm2d_loaderJobs;
+static std::vector<std::thread> imm2d_loaderThreads;
+static bool imm2d_loaderStopped = false;
+
+static void imm2d_LoaderThread()
+{
+    while (true)
+    {
+        Imm2dLoadJob job;
+        {
+            std::unique_lock<std::mutex> lock(imm2d_loaderLock);
+            imm2d_loaderWake.wait(lock, [] { return imm2d_loaderStopped || !imm2d_loaderJobs.empty(); });
+            if (imm2d_loaderStopped) return;
+
+            job = std::move(imm2d_loaderJobs.front());
+            imm2d_loaderJobs.pop_front();
+        }
+
+        Imm2dDecodedImage image;
+        const bool loaded = imm2d_LoadImageData(job.name.c_str(), image);
+        imm2d_FinishImage(job.image, job.reload, loaded, std::move(image));
+    }
+}
+
+// Puts a job in line for the loader threads (starting them if this is the first one).
+// Returns false if we're on our way out and there's nobody left to load it.
+static bool imm2d_QueueLoad(Imm2dLoadJob &&job)
+{
+    std::lock_guard<std::mutex> lock(imm2d_loaderLock);
+    if (imm2d_loaderStopped) return false;
+
+    if (imm2d_loaderThreads.empty())
+    {
+        const unsigned threadCount = std::max(1U, std::thread::hardware_concurrency());
+        for (unsigned t = 0; t < threadCount; ++t) imm2d_loaderThreads.emplace_back(imm2d_LoaderThread);
+    }
+
+    // Images that were let go are already waiting to be drawn, so they cut in line
+    if (job.reload) imm2d_loaderJobs.push_front(std::move(job));
+    else imm2d_loaderJobs.push_back(std::move(job));
+    imm2d_loaderWake.notify_one();
+    return true;
+}
+
+// Finds (or starts loading) the image with this name, without waiting for it.  The
+// handle's generation is passed back for imm2d_WaitForImage.
+static Image imm2d_RequestImage(const char *name, uint32_t &generation)
+{
+    if (!name) return InvalidImage;
+
+    {
+        std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+        if (imm2d_pixels.empty()) return InvalidImage;
+    }
+
+    const uint64_t nameHash = imm2d_Hash(name, std::strlen(name));
+    bool added;
+    const Image result = imm2d_FindOrAddImage(name, nameHash, added, generation);
+    if (added && !imm2d_QueueLoad(Imm2dLoadJob{ result, name, false }))
+        imm2d_FinishImage(result, false, false, Imm2dDecodedImage());
+
+    return result;
+}
+
+// Only called while mediaLock is held.  If an image was let go to stay under the memory budget,
+// puts it in line to be loaded again and returns true.
+static bool imm2d_ReloadImage(Image i)
+{
+    if (imm2d_imageStates[i] != Imm2dImageState::Evicted) return false;
+    if (!imm2d_QueueLoad(Imm2dLoadJob{ i, imm2d_imageNames[i], true })) return false;
+
+    imm2d_imageStates[i] = Imm2dImageState::Reloading;
+    return true;
+}
+
+// Waits for an image to finish loading, giving back InvalidImage if it couldn't be.  (If the
+// generation changed, the load failed and the handle may already belong to something else.)
+static Image imm2d_WaitForImage(Image i, uint32_t generation)
+{
+    if (i < 0) return InvalidImage;
+
+    std::unique_lock<std::mutex> lock(imm2d_mediaLock);
+    const auto settled = [i, generation] {
+        return imm2d_imageStates.size() <= static_cast<size_t>(i) || imm2d_imageGenerations[i] != generation || imm2d_imageStates[i] != Imm2dImageState::Loading;
+    };
+    imm2d_imageLoaded.wait(lock, settled);
+
+    if (imm2d_imageStates.size() <= static_cast<size_t>(i) || imm2d_imageGenerations[i] != generation) return InvalidImage;
+
+    // An image that was let go to stay under the budget is still good.  Since it's
+    // being asked for, it will probably be drawn soon, so start loading it again.
+    imm2d_ReloadImage(i);
+    return i;
+}
+
+// Called once, on the way out.  Anything still waiting in line is given up on.
+static void imm2d_StopLoaders()
+{
+    std::deque<Imm2dLoadJob> abandoned;
+    std::vector<std::thread> threads;
+    {
+        std::lock_guard<std::mutex> lock(imm2d_loaderLock);
+        imm2d_loaderStopped = true;
+        abandoned.swap(imm2d_loaderJobs);
+        threads.swap(imm2d_loaderThreads);
+    }
+
+    imm2d_loaderWake.notify_all();
+    for (auto &thread : threads) thread.join();
+    for (auto &job : abandoned) imm2d_FinishImage(job.image, job.reload, false, Imm2dDecodedImage());
+}
+
+Image LoadImage(const char *name)
+{
+    uint32_t generation = 0;
+    const Image i = imm2d_RequestImage(name, generation);
+    return imm2d_WaitForImage(i, generation);
+}
+
+Image LoadImageAsync(const char *name)
+{
+    uint32_t generation = 0;
+    return imm2d_RequestImage(name, generation);
+}
+
+bool IsImageReady(Image i)
+{
+    if (i < 0) return false;
+
+    std::lock_guard<std::mutex> lock(imm2d_mediaLock);
+    if (imm2d_imageStates.size() <= static_cast<size_t>(i)) return false;
+
+    // (Images that were let go to stay under the memory budget still count, since drawing them loads them again)
+    const auto state = imm2d_imageStates[i];
+    return state == Imm2dImageState::Loaded || state == Imm2dImageState::Evicted || state == Imm2dImageState::Reloading;
+}
+
+void LoadImages(const char *const *names, int count, Image *images)
+{
+    if (!names || !images || count <= 0) return;
+
+    // Everything goes in line first, so the loader threads can all get to work on it at once
+    std::vector<uint32_t> generations(count);
+    for (int k = 0; k < count; ++k) images[k] = imm2d_RequestImage(names[k], generations[k]);
+    for (int k = 0; k < count; ++k) images[k] = imm2d_WaitForImage(images[k], generations[k]);
+}
+
+void UnloadImage(Image i)
+{
+    if (i < 0) return;
+
+    std::unique_lock<std::mutex> lock(imm2d_mediaLock);
+
+    // If it's still loading, let that finish first so a loader thread isn't still
+    // working on this handle after it's been handed out to somebody else
+    imm2d_imageLoaded.wait(lock, [i] {
+        if (imm2d_imageStates.size() <= static_cast<size_t>(i)) return true;
+        return imm2d_imageStates[i] != Imm2dImageState::Loading && imm2d_imageStates[i] != Imm2dImageState::Reloading;
+    });
+    if (imm2d_imageStates.size() <= static_cast<size_t>(i) || imm2d_imageStates[i] == Imm2dImageState::Unloaded) return;
+
+    imm2d_ReleaseImage(i);
+    imm2d_imageLoaded.notify_all();
+}
+
+void SetImageMemoryBudget(long long bytes)
+{
+    std::lock_guard<std::mutex> lock(imm2d_mediaLock);
+    imm2d_imageMemoryBudget = std::max(0LL, bytes);
+    imm2d_TrimImages();
+}
+
+// Only called while both bitmapLock and mediaLock are held.  ("now" is passed in so
+// a whole batch of sprites can share it.)
+static void imm2d_BlitImage(int x, int y, Image i, uint64_t now)
+{
+    if (i < 0 || imm2d_images.size() <= static_cast<size_t>(i)) return;
+
+    // (Images have no pixels while they're loading, or after they've been let go)
+    const auto &image = imm2d_images[i];
+    if (image.empty()) return;
+
+    const int w = imm2d_imageSizes[i].first, h = imm2d_imageSizes[i].second;
+
+    // Nothing to do for images that are completely off the screen
+    if (x >= Width || y >= Height || x + w <= 0 || y + h <= 0) return;
+
+    // Animation frames are stored one after the other
+    uint32_t frameId = 0;
+    const auto &cumulative = imm2d_imageFrameCumulativeCentiSeconds[i];
+    if (!cumulative.empty())
+    {
+        const auto wrapped = now % std::max(1U, imm2d_imageFrameSumMs[i]);
+
+        auto found = std::lower_bound(cumulative.cbegin(), cumulative.cend(), wrapped / 10);
+        frameId = static_cast<uint32_t>(std::min<ptrdiff_t>(std::distance(cumulative.cbegin(), found), cumulative.size() - 1));
+    }
+
+    // Only the rows that are actually on the screen are blended
+    const uint32_t *frame = image.data() + size_t(frameId) * w * h;
+    for (int row = std::max(0, -y); row < std::min(h, Height - y); ++row)
+    {
+        int left = x, length = w;
+        const int skipped = imm2d_ClipSpan(left, y + row, length);
+        if (skipped >= 0) imm2d_BlendPixels(imm2d_PixelAt(left, y + row), frame + size_t(row) * w + skipped, size_t(length));
+    }
+
+    imm2d_SetDirty(x, y, x + w, y + h);
+}
+
+// Only called while mediaLock is held.  Stamps an image that's about to be drawn, and if it
+// was let go to stay under the memory budget, puts it at the front of the line to be loaded
+// again.  It's skipped this time (just like an image from LoadImageAsync that isn't ready
+// yet), so drawing never has to wait on a loader thread.
+static void imm2d_TouchImage(Image i, uint64_t stamp)
+{
+    if (i < 0 || imm2d_imageStates.size() <= static_cast<size_t>(i)) return;
+
+    imm2d_imageLastDrawn[i] = stamp;
+    imm2d_ReloadImage(i);
+}
+
+static void imm2d_DrawImage(int x, int y, Image i)
+{
+    std::lock_guard<std::mutex> lock(imm2d_mediaLock);
+
+    imm2d_TouchImage(i, ++imm2d_imageClock);
+    imm2d_BlitImage(x, y, i, imm2d_RunDuration());
+}
+
+static void imm2d_DrawSprites(const SpriteInstance *sprites, int count)
+{
+    std::lock_guard<std::mutex> lock(imm2d_mediaLock);
+
+    const uint64_t stamp = ++imm2d_imageClock;
+    for (int k = 0; k < count; ++k) imm2d_TouchImage(sprites[k].image, stamp);
+
+    const uint64_t now = imm2d_RunDuration();
+    for (int k = 0; k < count; ++k) imm2d_BlitImage(sprites[k].x, sprites[k].y, sprites[k].image, now);
+}
+
+//
+// Deferred drawing
+//
+// With UseDeferredDrawing(true), the public drawing functions below append a small
+// Imm2dCommand to a list instead of taking bitmapLock and drawing.  Present() then
+// replays the lists in one pass, which is where the merging happens.
+//
+// Each thread that draws gets its own list (with its own lock that only Present ever
+// competes for), so something like an OpenMP loop full of DrawPixel calls doesn't make
+// every thread wait its turn on bitmapLock.  The lists are played back one thread after
+// another, so each thread's drawing stays in order, but the order *between* threads
+// isn't guaranteed (which was already true for threads drawing at the same time).
+//
+
+enum class Imm2dOp : uint8_t { Pixel, Span, SpanCopy, Line, Rectangle, Circle, Arc, String, Image };
+
+struct Imm2dCommand
+{
+    Imm2dOp op;
+    bool centered;
+    Color c1, c2;
+
+    // Integer arguments (x, y, sizes, or offsets into the buffer's colors/text) for the
+    // integer-based drawing functions, and float arguments for the rest.
+    union { int i[6]; float f[6]; };
+};
+
+struct Imm2dCommandBuffer
+{
+    std::vector<Imm2dCommand> commands;
+
+    // Variable-length arguments (DrawHorizontalSpan's colors and DrawString's text)
+    std::vector<Color> colors;
+    std::string text;
+
+    void clear() { commands.clear(); colors.clear(); text.clear(); }
+};
+
+struct Imm2dThreadQueue
+{
+    std::mutex lock;
+    Imm2dCommandBuffer recording;
+    Imm2dCommandBuffer playback;
+};
+
+static std::atomic<bool> imm2d_deferred{ false };
+
+// Only locked the first time each thread draws, and by Present/Clear
+static std::mutex imm2d_queueLock;
+static std::vector<std::shared_ptr<Imm2dThreadQueue>> imm2d_queues;
+
+// Clear throws away everything recorded (by any thread) before it, so instead of being
+// recorded itself, it just remembers which color the next Present should start with.
+static bool imm2d_clearPending = false;
+static Color imm2d_clearColor = Black;
+
+static Imm2dThreadQueue &imm2d_ThisThreadQueue()
+{
+    // The registry shares ownership so anything a thread draws just before it exits still
+    // makes it to the screen.  Present forgets about the queue after that.
+    thread_local std::shared_ptr<Imm2dThreadQueue> queue;
+    if (!queue)
+    {
+        queue = std::make_shared<Imm2dThreadQueue>();
+
+        std::lock_guard<std::mutex> lock(imm2d_queueLock);
+        imm2d_queues.push_back(queue);
+    }
+
+    return *queue;
+}
+
+static Imm2dCommand imm2d_IntCommand(Imm2dOp op, Color c1, Color c2, std::initializer_list<int> args)
+{
+    Imm2dCommand c{ op, false, c1, c2, {} };
+    std::copy(args.begin(), args.end(), c.i);
+    return c;
+}
+
+static Imm2dCommand imm2d_FloatCommand(Imm2dOp op, Color c1, Color c2, std::initializer_list<float> args)
+{
+    Imm2dCommand c{ op, false, c1, c2, {} };
+    std::copy(args.begin(), args.end(), c.f);
+    return c;
+}
+
+// Returns false (without doing anything) when the caller should draw immediately instead
+static bool imm2d_Record(const Imm2dCommand &c)
+{
+    if (!imm2d_deferred) return false;
+
+    Imm2dThreadQueue &q = imm2d_ThisThreadQueue();
+    std::lock_guard<std::mutex> lock(q.lock);
+    q.recording.commands.push_back(c);
+    return true;
+}
+
+static bool imm2d_Record(Imm2dCommand c, const Color *colors, int count)
+{
+    if (!imm2d_deferred) return false;
+
+    Imm2dThreadQueue &q = imm2d_ThisThreadQueue();
+    std::lock_guard<std::mutex> lock(q.lock);
+    c.i[3] = static_cast<int>(q.recording.colors.size());
+    q.recording.colors.insert(q.recording.colors.end(), colors, colors + count);
+    q.recording.commands.push_back(c);
+    return true;
+}
+
+static bool imm2d_Record(Imm2dCommand c, const char *text, const char *fontName)
+{
+    if (!imm2d_deferred) return false;
+
+    Imm2dThreadQueue &q = imm2d_ThisThreadQueue();
+    std::lock_guard<std::mutex> lock(q.lock);
+
+    // Both strings are stored with their null terminators so they can be used in place
+    auto &t = q.recording.text;
+    c.i[3] = static_cast<int>(t.size());
+    t.append(text).push_back('\0');
+    c.i[4] = static_cast<int>(t.size());
+    t.append(fontName).push_back('\0');
+
+    q.recording.commands.push_back(c);
+    return true;
+}
+
+// The whole batch goes into the list as separate DrawImage commands, but with only one trip
+// through the thread's lock
+static bool imm2d_Record(const SpriteInstance *sprites, int count)
+{
+    if (!imm2d_deferred) return false;
+
+    Imm2dThreadQueue &q = imm2d_ThisThreadQueue();
+    std::lock_guard<std::mutex> lock(q.lock);
+    for (int k = 0; k < count; ++k)
+        if (sprites[k].image >= 0) q.recording.commands.push_back(imm2d_IntCommand(Imm2dOp::Image, Transparent, Transparent, { sprites[k].x, sprites[k].y, sprites[k].image }));
+
+    return true;
+}
+
+static bool imm2d_RecordClear(Color c)
+{
+    if (!imm2d_deferred) return false;
+
+    std::lock_guard<std::mutex> lock(imm2d_queueLock);
+    for (auto &q : imm2d_queues)
+    {
+        std::lock_guard<std::mutex> queueLock(q->lock);
+        q->recording.clear();
+    }
+
+    imm2d_clearPending = true;
+    imm2d_clearColor = c;
+    return true;
+}
+
+static void imm2d_Execute(const Imm2dCommand &c, const Imm2dCommandBuffer &buffer)
+{
+    switch (c.op)
+    {
+    case Imm2dOp::Pixel:     imm2d_BlendPixel(c.i[0], c.i[1], c.c1); imm2d_SetPixelsDirty(c.i[0], c.i[1], c.i[0] + 1, c.i[1] + 1); break;
+    case Imm2dOp::Span:      imm2d_DrawSpan(c.i[0], c.i[1], c.i[2], c.c1); break;
+    case Imm2dOp::SpanCopy:  imm2d_DrawColors(c.i[0], c.i[1], buffer.colors.data() + c.i[3], c.i[2]); break;
+    case Imm2dOp::Line:      imm2d_DrawLine(c.f[0], c.f[1], c.f[2], c.f[3], c.f[4], c.c1); break;
+    case Imm2dOp::Rectangle: imm2d_DrawRectangle(c.i[0], c.i[1], c.i[2], c.i[3], c.c1, c.c2); break;
+    case Imm2dOp::Circle:    imm2d_DrawCircle(c.f[0], c.f[1], c.f[2], c.c1, c.c2); break;
+    case Imm2dOp::Arc:       imm2d_DrawArc(c.f[0], c.f[1], c.f[2], c.f[3], c.c1, c.f[4], c.f[5]); break;
+    case Imm2dOp::String:    imm2d_DrawString(c.i[0], c.i[1], &buffer.text[c.i[3]], &buffer.text[c.i[4]], c.i[2], c.c1, c.centered); break;
+    case Imm2dOp::Image:     imm2d_DrawImage(c.i[0], c.i[1], c.i[2]); break;
+    }
+}
+
+// Plays back a list of recorded commands.  Must be called while bitmapLock is held.
+static void imm2d_Replay(Imm2dCommandBuffer &buffer)
+{
+    auto &commands = buffer.commands;
+
+    size_t i = 0;
+    while (i < commands.size())
+    {
+        const Imm2dCommand &c = commands[i];
+
+        if (c.op == Imm2dOp::Pixel)
+        {
+            // Neighboring pixels can be drawn in any order without changing the result (as long as
+            // two pixels at the same spot stay in the order they were drawn), so sort each run of
+            // them into rows and merge any that line up with the same color into spans.
+            size_t end = i;
+            while (end < commands.size() && commands[end].op == Imm2dOp::Pixel) ++end;
+
+            // (Pixels are usually drawn a row at a time already, which is quick to check.)
+            const auto rowOrder = [](const Imm2dCommand &a, const Imm2dCommand &b) {
+                return a.i[1] != b.i[1] ? a.i[1] < b.i[1] : a.i[0] < b.i[0];
+            };
+            if (!std::is_sorted(commands.begin() + i, commands.begin() + end, rowOrder))
+                std::stable_sort(commands.begin() + i, commands.begin() + end, rowOrder);
+
+            // Anything drawn at one spot before the last solid pixel there is covered up by it
+            // (but see-through pixels after that still have to be blended, in order)
+            size_t kept = i;
+            for (size_t j = i; j < end; )
+            {
+                size_t spotEnd = j + 1, spotStart = j;
+                while (spotEnd < end && commands[spotEnd].i[0] == commands[j].i[0] && commands[spotEnd].i[1] == commands[j].i[1]) ++spotEnd;
+                for (size_t k = j; k < spotEnd; ++k) if ((commands[k].c1 >> 24) == 255) spotStart = k;
+
+                for (size_t k = spotStart; k < spotEnd; ++k) commands[kept++] = commands[k];
+                j = spotEnd;
+            }
+
+            for (size_t j = i; j < kept; )
+            {
+                const Imm2dCommand &first = commands[j];
+
+                int length = 1;
+                while (j + length < kept)
+                {
+                    const Imm2dCommand &next = commands[j + length];
+                    if (next.i[1] != first.i[1] || next.i[0] != first.i[0] + length || next.c1 != first.c1) break;
+                    ++length;
+                }
+
+                imm2d_DrawSpan(first.i[0], first.i[1], length, first.c1);
+                j += length;
+            }
+
+            i = end;
+            continue;
+        }
+
+        if (c.op == Imm2dOp::Rectangle && c.c2 == Transparent && c.i[2] > 0 && c.i[3] > 0)
+        {
+            // Filled rectangles stacked directly on top of one another (like rows of a
+            // tile map or a bar graph) become one taller rectangle.
+            int height = c.i[3];
+            size_t j = i + 1;
+            for (; j < commands.size(); ++j)
+            {
+                const Imm2dCommand &next = commands[j];
+                if (next.op != Imm2dOp::Rectangle || next.c1 != c.c1 || next.c2 != Transparent) break;
+                if (next.i[0] != c.i[0] || next.i[2] != c.i[2] || next.i[1] != c.i[1] + height || next.i[3] <= 0) break;
+                height += next.i[3];
+            }
+
+            // Skip anything that would land entirely off the screen
+            if (c.i[0] < Width && c.i[1] < Height && c.i[0] + c.i[2] > 0 && c.i[1] + height > 0)
+                imm2d_DrawRectangle(c.i[0], c.i[1], c.i[2], height, c.c1, Transparent);
+
+            i = j;
+            continue;
+        }
+
+        imm2d_Execute(c, buffer);
+        ++i;
+    }
+}
+
+// Grabs everything every thread has recorded so far and plays it back
+static void imm2d_FlushRecorded()
+{
+    std::lock_guard<std::mutex> lock(imm2d_queueLock);
+
+    // Each thread is left with an empty list (kept from last time) to keep drawing into
+    bool anything = imm2d_clearPending;
+    for (auto &q : imm2d_queues)
+    {
+        std::lock_guard<std::mutex> queueLock(q->lock);
+        std::swap(q->recording, q->playback);
+        anything |= !q->playback.commands.empty();
+    }
+
+    if (anything)
+    {
+        std::lock_guard<std::mutex> bitmapLock(imm2d_bitmapLock);
+        if (!imm2d_pixels.empty())
+        {
+            if (imm2d_clearPending) imm2d_Clear(imm2d_clearColor);
+            for (auto &q : imm2d_queues) imm2d_Replay(q->playback);
+        }
+    }
+
+    imm2d_clearPending = false;
+    for (auto &q : imm2d_queues) q->playback.clear();
+
+    // Forget about threads that have exited (once everything they drew is on the screen)
+    imm2d_queues.erase(std::remove_if(imm2d_queues.begin(), imm2d_queues.end(), [](const std::shared_ptr<Imm2dThreadQueue> &q) {
+        std::lock_guard<std::mutex> queueLock(q->lock);
+        return q.use_count() == 1 && q->recording.commands.empty();
+    }), imm2d_queues.end());
+}
+
+void UseDeferredDrawing(bool enabled)
+{
+    imm2d_deferred = enabled;
+
+    // Anything still waiting when deferred drawing is turned off is drawn right away
+    if (!enabled) imm2d_FlushRecorded();
+}
+
+int DeferredCommandCount()
+{
+    std::lock_guard<std::mutex> lock(imm2d_queueLock);
+
+    size_t count = 0;
+    for (auto &q : imm2d_queues)
+    {
+        std::lock_guard<std::mutex> queueLock(q->lock);
+        count += q->recording.commands.size();
+    }
+
+    return static_cast<int>(count);
+}
+
+
+
+//
+// The public drawing functions.  Each one either records itself for later (when
+// deferred drawing is on) or draws immediately using the functions above.
+//
+
+void DrawPixel(int x, int y, Color c)
+{
+    if (x < 0 || x >= Width || y < 0 || y >= Height) return;
+    if (imm2d_Record(imm2d_IntCommand(Imm2dOp::Pixel, c, Transparent, { x, y }))) return;
 
     std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
-    if (!imm2d_graphics) return;
+    if (imm2d_pixels.empty()) return;
 
-    static auto getFont = [](std::string name, int size) {
-        const std::pair<std::string, int> key{ name, size };
+    imm2d_BlendPixel(x, y, c);
+    imm2d_SetPixelsDirty(x, y, x + 1, y + 1);
+}
 
-        const auto found = imm2d_fonts.find(key);
-        if (found != imm2d_fonts.end()) return &found->second;
+void DrawPixels(const PixelPoint *pixels, int count)
+{
+    if (!pixels || count <= 0) return;
 
-        imm2d_fonts[key] = std::make_unique<Gdiplus::Font>(imm2d_ToWide(name.c_str()).c_str(), static_cast<Gdiplus::REAL>(size));
-        return &imm2d_fonts[key];
-    };
+    if (imm2d_deferred)
+    {
+        Imm2dThreadQueue &q = imm2d_ThisThreadQueue();
+        std::lock_guard<std::mutex> lock(q.lock);
+        for (const PixelPoint *p = pixels, *end = pixels + count; p != end; ++p)
+            if (unsigned(p->x) < unsigned(Width) && unsigned(p->y) < unsigned(Height))
+                q.recording.commands.push_back(imm2d_IntCommand(Imm2dOp::Pixel, p->c, Transparent, { p->x, p->y }));
+        return;
+    }
 
-    const auto wide = imm2d_ToWide(text);
-    const auto font = getFont(fontName, fontPtSize);
-    const Gdiplus::SolidBrush brush(c);
-    const Gdiplus::PointF origin{ static_cast<Gdiplus::REAL>(x), static_cast<Gdiplus::REAL>(y) };
-    Gdiplus::StringFormat format;
-    format.SetAlignment(centered ? Gdiplus::StringAlignmentCenter : Gdiplus::StringAlignmentNear);
+    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+    if (imm2d_pixels.empty()) return;
+
+    // Casting to unsigned turns the four bounds checks into two
+    uint32_t *screen = imm2d_pixels.data();
+    int left = Width, top = Height, right = 0, bottom = 0;
+    for (const PixelPoint *p = pixels, *end = pixels + count; p != end; ++p)
+    {
+        if (unsigned(p->x) >= unsigned(Width) || unsigned(p->y) >= unsigned(Height)) continue;
+
+        uint32_t &pixel = screen[size_t(p->y) * Width + p->x];
+        pixel = imm2d_Blend(pixel, p->c);
+
+        left = std::min(left, p->x);
+        top = std::min(top, p->y);
+        right = std::max(right, p->x + 1);
+        bottom = std::max(bottom, p->y + 1);
+    }
 
-    bool aa = imm2d_graphics->GetSmoothingMode() == Gdiplus::SmoothingModeAntiAlias;
-    imm2d_graphics->SetTextRenderingHint(aa ? Gdiplus::TextRenderingHintAntiAlias : Gdiplus::TextRenderingHintSingleBitPerPixelGridFit);
-    imm2d_graphics->DrawString(wide.c_str(), static_cast<INT>(wide.length()), font->get(), origin, &format, &brush);
-    imm2d_SetDirty();
+    if (left < right) imm2d_SetPixelsDirty(left, top, right, bottom);
 }
 
-void Clear(Color c)
+void DrawHorizontalSpan(int x, int y, int length, Color c)
 {
+    if (imm2d_ClipSpan(x, y, length) < 0) return;
+    if (imm2d_Record(imm2d_IntCommand(Imm2dOp::Span, c, Transparent, { x, y, length }))) return;
+
     std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
-    if (!imm2d_graphics) return;
+    if (imm2d_pixels.empty()) return;
 
-    imm2d_graphics->Clear(Gdiplus::Color(c));
-    imm2d_SetDirty();
+    imm2d_DrawSpan(x, y, length, c);
 }
 
-Gdiplus::Bitmap *imm2d_CheckedLoad(Gdiplus::Bitmap *b)
+void DrawHorizontalSpan(int x, int y, const Color *colors, int count)
 {
-    // It's not enough to try and load a GDI+ bitmap.  It can return
-    // a valid pointer even when it wasn't able to load anything. You
-    // have to check the image status, too.  So we pass all of our
-    // load calls through this double-checker.
+    if (!colors) return;
 
-    if (!b || b->GetLastStatus() == Gdiplus::Ok) return b;
+    const int skipped = imm2d_ClipSpan(x, y, count);
+    if (skipped < 0) return;
+    if (imm2d_Record(imm2d_IntCommand(Imm2dOp::SpanCopy, Transparent, Transparent, { x, y, count }), colors + skipped, count)) return;
 
-    delete b;
-    return nullptr;
+    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+    if (imm2d_pixels.empty()) return;
+
+    imm2d_DrawColors(x, y, colors + skipped, count);
 }
 
-Gdiplus::Bitmap *imm2d_LoadResourceImage(const char *resourceName)
+void Present(const std::vector<Color> &screen)
 {
-    const HRSRC id = FindResourceA(nullptr, resourceName, "IMAGES");
-    if (!id) return nullptr;
+    if (screen.size() != Width * Height) return;
 
-    const auto size = SizeofResource(nullptr, id);
-    if (!size) return nullptr;
+    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+    if (imm2d_pixels.empty()) return;
 
-    const auto resource = LoadResource(nullptr, id);
-    if (!resource) return nullptr;
+    auto &b = imm2d_doubleBuffered ? imm2d_pixelsOther : imm2d_pixels;
+    std::copy(screen.begin(), screen.end(), b.begin());
+    imm2d_frontDirty.addAll();
+    imm2d_FrontChanged();
+}
 
-    void *bytes = LockResource(resource);
-    if (!bytes) { FreeResource(resource); return nullptr; }
+void PresentSwap(std::vector<Color> &screen)
+{
+    if (screen.size() != Width * Height) return;
 
-    IStream *stream = SHCreateMemStream(static_cast<BYTE*>(bytes), size);
-    if (!stream) { FreeResource(resource); return nullptr; }
+    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+    if (imm2d_pixels.empty()) return;
 
-    auto *result = imm2d_CheckedLoad(Gdiplus::Bitmap::FromStream(stream));
-    stream->Release();
-    FreeResource(resource);
+    if (imm2d_doubleBuffered)
+    {
+        imm2d_pixelsOther.swap(screen);
+#ifndef IMM2D_HEADLESS
+        imm2d_Rewrap(imm2d_pixelsOther, imm2d_bitmapOther, imm2d_graphicsOther);
+#endif
+    }
+    else
+    {
+        imm2d_pixels.swap(screen);
+#ifndef IMM2D_HEADLESS
+        imm2d_Rewrap(imm2d_pixels, imm2d_bitmap, imm2d_graphics);
+#endif
+    }
 
-    if (result->GetLastStatus() != Gdiplus::Ok) result = nullptr;
-    return result;
+    imm2d_frontDirty.addAll();
+    imm2d_FrontChanged();
 }
 
-Gdiplus::Bitmap *imm2d_LoadBase64Image(const char *base64)
+Color ReadPixel(int x, int y)
 {
-    // Base64 decoding snippet adapted from https://stackoverflow.com/a/34571089
+    if (x < 0 || x >= Width || y < 0 || y >= Height) return Black;
 
-    static const std::vector<int> T = []{
-        std::vector<int> lookup(256, -1);
-        for (int i = 0; i < 64; i++) lookup["ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"[i]] = i;
-        return lookup;
-    }();
+    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+    if (imm2d_pixels.empty()) return Black;
 
-    std::string decoded;
-    unsigned int val = 0;
-    int valb = -8;
-    while (*base64)
+    return *imm2d_PixelAt(x, y);
+}
+
+void ReadPixels(int x, int y, int width, int height, Color *destination)
+{
+    if (!destination || width <= 0 || height <= 0) return;
+
+    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+    const bool ready = !imm2d_pixels.empty();
+
+    for (int row = 0; row < height; ++row)
     {
-        const char c = *(base64++);
-        const int lookup = T[c];
-        if (lookup == -1)
-        {
-            // Unless this was padding, invalid data means this wasn't Base64 to begin with
-            if (c != '=') decoded.clear();
-            break;
-        }
+        Color *out = destination + size_t(row) * width;
 
-        val = (val << 6) + lookup, valb += 6;
-        if (valb >= 0) { decoded.push_back(char((val >> valb) & 0xFF)); valb -= 8; }
+        int left = x, length = width;
+        const int skipped = ready ? imm2d_ClipSpan(left, y + row, length) : -1;
+        if (skipped < 0) { std::fill_n(out, width, Black); continue; }
+
+        std::fill_n(out, skipped, Black);
+        std::memcpy(out + skipped, imm2d_PixelAt(left, y + row), length * sizeof(Color));
+        std::fill(out + skipped + length, out + width, Black);
     }
+}
 
-    if (decoded.empty()) return nullptr;
+void DrawLine(float x1, float y1, float x2, float y2, int thickness, Color c)
+{
+    if (imm2d_Record(imm2d_FloatCommand(Imm2dOp::Line, c, Transparent, { x1, y1, x2, y2, float(thickness) }))) return;
 
-    IStream *stream = SHCreateMemStream((const BYTE*)decoded.data(), (UINT)decoded.size());
-    if (!stream) return nullptr;
+    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+    if (imm2d_pixels.empty()) return;
 
-    auto *result = imm2d_CheckedLoad(Gdiplus::Bitmap::FromStream(stream));
-    stream->Release();
+    imm2d_DrawLine(x1, y1, x2, y2, float(thickness), c);
+}
 
-    return result;
+void DrawLine(int x1, int y1, int x2, int y2, int thickness, Color c)
+{
+    DrawLine(float(x1), float(y1), float(x2), float(y2), thickness, c);
 }
 
-// Are we being a bad neighbor?  What's the likelihood that the user wants to use the
-// Win32 API version of LoadImage in the same compilation unit as our implementation?
-#ifdef LoadImage
-#undef LoadImage
-#endif
+void DrawCircle(float x, float y, float radius, Color fill, Color stroke)
+{
+    if (imm2d_Record(imm2d_FloatCommand(Imm2dOp::Circle, fill, stroke, { x, y, radius }))) return;
 
-Image LoadImage(const char *name)
+    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+    if (imm2d_pixels.empty()) return;
+
+    imm2d_DrawCircle(x, y, radius, fill, stroke);
+}
+
+void DrawCircle(int x, int y, int radius, Color fill, Color stroke)
 {
-    if (!name) return InvalidImage;
+    DrawCircle(float(x), float(y), float(radius), fill, stroke);
+}
+
+void DrawArc(int x, int y, float radius, float thickness, Color c, float startRadians, float endRadians)
+{
+    if (imm2d_Record(imm2d_FloatCommand(Imm2dOp::Arc, c, Transparent, { float(x), float(y), radius, thickness, startRadians, endRadians }))) return;
 
     std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
-    if (!imm2d_graphics) return InvalidImage;
+    if (imm2d_pixels.empty()) return;
 
-    // Try the Base64 case from the outset (which fails almost immediately
-    // if the string being passed in isn't actually Base64 data)
-    Gdiplus::Bitmap *result = imm2d_LoadBase64Image(name);
+    imm2d_DrawArc(float(x), float(y), radius, thickness, c, startRadians, endRadians);
+}
 
-    // TODO: After 50 images, start storing a path-->Image map and checking it before re-loading.
-    //       (This gets trickier with huge Base64-encoded inputs.  Maybe hash-->Image, instead?)
+void DrawRectangle(int x, int y, int width, int height, Color fill, Color stroke)
+{
+    if (imm2d_Record(imm2d_IntCommand(Imm2dOp::Rectangle, fill, stroke, { x, y, width, height }))) return;
 
-    if (!result) result = imm2d_LoadResourceImage(name);
+    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+    if (imm2d_pixels.empty()) return;
 
-    // TODO: Work much harder to find the file!
-    if (!result) result = imm2d_CheckedLoad(Gdiplus::Bitmap::FromFile(imm2d_ToWide(name).c_str()));
+    imm2d_DrawRectangle(x, y, width, height, fill, stroke);
+}
 
-    if (!result) return InvalidImage;
-    const UINT frameCount = result->GetFrameCount(&Gdiplus::FrameDimensionTime);
+void DrawString(int x, int y, const char *text, const char *fontName, int fontPtSize, const Color c, bool centered)
+{
+    if (!text || !fontName) return;
+    if (fontPtSize < 1 || !text[0]) return;
 
-    std::lock_guard<std::mutex> lock2(imm2d_mediaLock);
-    imm2d_imageSizes.push_back(std::pair<int, int>(result->GetWidth(), result->GetHeight()));
-    imm2d_images.push_back(std::unique_ptr<Gdiplus::Bitmap>(result));
+    Imm2dCommand command = imm2d_IntCommand(Imm2dOp::String, c, Transparent, { x, y, fontPtSize });
+    command.centered = centered;
+    if (imm2d_Record(command, text, fontName)) return;
 
-    imm2d_imageFrameCount.push_back(frameCount);
-    imm2d_imageFrameStart.push_back(imm2d_imageFrameCumulativeCentiSeconds.size());
-    imm2d_imageFrameSumMs.push_back(0);
+    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+    if (imm2d_pixels.empty()) return;
 
-    if (frameCount > 0)
-    {
-        // GDI+ follows the usual Win32 convention of making you request the size of
-        // the thing first, then having you provide a big enough buffer to fill it.
-        // In this case, "it" is the list of "centi"-second delay between frames.
-        const UINT bufferSize = result->GetPropertyItemSize(PropertyTagFrameDelay);
-        auto itemBuffer = std::make_unique<uint8_t[]>(bufferSize);
+    imm2d_DrawString(x, y, text, fontName, fontPtSize, c, centered);
+}
 
-        auto *item = reinterpret_cast<Gdiplus::PropertyItem *>(itemBuffer.get());
-        result->GetPropertyItem(PropertyTagFrameDelay, bufferSize, item);
-        const auto *frameCentiSeconds = reinterpret_cast<long*>(item->value);
+CacheStats TextCacheStats()
+{
+    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+    return imm2d_textCacheStats;
+}
 
-        // TODO: What do "infinite"-length frames at the end of a GIF look like?
-        // TODO: What does PropertyTagLoopCount look like?  Is that how we detect infinite loops?
+int MeasureString(const char *text, const char *fontName, int fontPtSize)
+{
+    if (!text || !fontName) return 0;
+    if (fontPtSize < 1 || !text[0]) return 0;
 
-        auto &sum = imm2d_imageFrameSumMs.back();
-        for (size_t i = 0; i < frameCount; ++i)
-        {
-            const auto cSec = frameCentiSeconds[i];
-            
-            // TODO: If "infinite"-length frames are anywhere near LONG_MAX, we should check for overflows
-            sum += cSec;
-            imm2d_imageFrameCumulativeCentiSeconds.push_back(sum);
-        }
-        sum *= 10;
-    }
+    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+    if (imm2d_pixels.empty()) return 0;
+
+    return imm2d_MeasureString(text, fontName, fontPtSize);
+}
 
-    return static_cast<Image>(imm2d_images.size() - 1);
+void DrawString(float *values, int width, int height, int x, int y, const char *text, float value, bool centered)
+{
+    imm2d_PixelFontInto(values, width, height, x, y, text, value, centered);
+}
+
+void DrawString(Color *colors, int width, int height, int x, int y, const char *text, Color c, bool centered)
+{
+    imm2d_PixelFontInto(colors, width, height, x, y, text, c, centered);
+}
+
+void Clear(Color c)
+{
+    if (imm2d_RecordClear(c)) return;
+
+    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+    if (imm2d_pixels.empty()) return;
+
+    imm2d_Clear(c);
 }
 
 void DrawImage(int x, int y, Image i)
 {
     if (i < 0) return;
+    if (imm2d_Record(imm2d_IntCommand(Imm2dOp::Image, Transparent, Transparent, { x, y, i }))) return;
 
     std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
-    if (!imm2d_graphics) return;
+    if (imm2d_pixels.empty()) return;
 
-    std::lock_guard<std::mutex> lock2(imm2d_mediaLock);
-    if (imm2d_images.size() <= static_cast<size_t>(i)) return;
+    imm2d_DrawImage(x, y, i);
+}
 
-    auto *image = imm2d_images[i].get();
-    const auto count = imm2d_imageFrameCount[i];
-    if (count > 0)
-    {
-        const uint64_t now = imm2d_runDuration;
-        const auto wrapped = now % std::max(1U, imm2d_imageFrameSumMs[i]);
+void DrawSprites(const SpriteInstance *sprites, int count)
+{
+    if (!sprites || count <= 0) return;
+    if (imm2d_Record(sprites, count)) return;
 
-        const auto begin = imm2d_imageFrameCumulativeCentiSeconds.cbegin() + imm2d_imageFrameStart[i];
-        auto found = std::lower_bound(begin, begin + imm2d_imageFrameCount[i], wrapped / 10);
+    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+    if (imm2d_pixels.empty()) return;
 
-        uint32_t frameId = 0;
-        if (found != imm2d_imageFrameCumulativeCentiSeconds.end()) frameId = static_cast<uint32_t>(std::distance(begin, found));
+    imm2d_DrawSprites(sprites, count);
+}
 
-        image->SelectActiveFrame(&Gdiplus::FrameDimensionTime, frameId);
-    }
+void Present()
+{
+    // This runs even if deferred drawing was just turned off, in case some other thread
+    // was still in the middle of recording something when it happened.
+    imm2d_FlushRecorded();
+
+    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+
+    // Without double buffering, everything has already been drawn to the visible surface
+    if (!imm2d_doubleBuffered) return;
 
-    imm2d_graphics->DrawImage(image, x, y);
-    imm2d_SetDirty();
+    // This is more "offscreen composition" than double-buffering.  Unless the user has told us
+    // (with DoubleBufferMode::Discard) that they're going to redraw the entire screen each frame,
+    // we assume immediate-mode drawing and make sure things are consistent instead of flickering
+    // each frame if you've got different sets of things drawn on each buffer.  (Both buffers are
+    // the same size, so this never allocates.)
+    if (!imm2d_discardBackBuffer) imm2d_pixelsOther = imm2d_pixels;
+
+    // The GDI+ wrappers point at the vectors' memory, which moves right along with them
+    std::swap(imm2d_pixels, imm2d_pixelsOther);
+#ifndef IMM2D_HEADLESS
+    std::swap(imm2d_graphics, imm2d_graphicsOther);
+    std::swap(imm2d_bitmap, imm2d_bitmapOther);
+#endif
+
+    // The window now only differs where the back-buffer was drawn on since last time.  (With
+    // Discard, the old back-buffer had an older frame on it, so we can't be sure of anything.)
+    imm2d_FlushPixelBox();
+    if (imm2d_discardBackBuffer) imm2d_frontDirty.addAll();
+    else imm2d_frontDirty.add(imm2d_backDirty);
+    imm2d_backDirty.clear();
+    imm2d_FrontChanged();
 }
 
 int ImageWidth(Image i)
@@ -1225,6 +5109,24 @@ int ImageHeight(Image i)
     return imm2d_imageSizes[i].second;
 }
 
+CacheStats ImageCacheStats()
+{
+    std::lock_guard<std::mutex> lock(imm2d_mediaLock);
+    return imm2d_imageCacheStats;
+}
+
+long long ImageMemoryUsage(Image i)
+{
+    std::lock_guard<std::mutex> lock(imm2d_mediaLock);
+
+    if (i == InvalidImage) return imm2d_imageMemoryUsed;
+
+    if (i < 0 || imm2d_images.size() <= static_cast<size_t>(i)) return 0;
+    return static_cast<long long>(imm2d_images[i].size() * sizeof(uint32_t));
+}
+
+
+#ifndef IMM2D_HEADLESS
 
 static DWORD WINAPI imm2d_musicThreadProc(LPVOID)
 {
@@ -1261,6 +5163,8 @@ static DWORD WINAPI imm2d_musicThreadProc(LPVOID)
     return 0;
 }
 
+#endif
+
 void PlayMusic(int noteId, int ms)
 {
     if (noteId < 0 || ms < 0) return;
@@ -1278,10 +5182,104 @@ void ResetMusic()
 }
 
 
+// Scaling the screen up for the window.  Only the window uses these, but they don't need
+// Windows, so they're left in headless builds for the tests to check.
+
+// Writes each of "count" pixels "scale" times in a row
+[[maybe_unused]] static void imm2d_WidenRow(const uint32_t *in, int count, uint32_t *out, int scale)
+{
+    int i = 0;
+    switch (scale)
+    {
+    case 1:
+        std::memcpy(out, in, count * sizeof(uint32_t));
+        return;
+
+#if defined(IMM2D_SSE2)
+    case 2:
+        for (; i + 4 <= count; i += 4, out += 8)
+        {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_unpacklo_epi32(v, v));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 4), _mm_unpackhi_epi32(v, v));
+        }
+        break;
+
+    case 3:
+        // Four pixels become three registers: 0001 1122 2333
+        for (; i + 4 <= count; i += 4, out += 12)
+        {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 0, 0)));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 4), _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 1, 1)));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 8), _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 2)));
+        }
+        break;
+
+    default:
+        // Anything bigger fills whole registers with one pixel at a time
+        for (; i < count; ++i, out += scale)
+        {
+            const __m128i v = _mm_set1_epi32(static_cast<int>(in[i]));
+            int k = 0;
+            for (; k + 4 <= scale; k += 4) _mm_storeu_si128(reinterpret_cast<__m128i *>(out + k), v);
+            for (; k < scale; ++k) out[k] = in[i];
+        }
+        break;
+
+#elif defined(IMM2D_NEON)
+    case 2:
+        for (; i + 4 <= count; i += 4, out += 8)
+        {
+            const uint32x4_t v = vld1q_u32(in + i);
+            const uint32x4x2_t doubled = vzipq_u32(v, v);
+            vst1q_u32(out, doubled.val[0]);
+            vst1q_u32(out + 4, doubled.val[1]);
+        }
+        break;
+
+    default:
+        if (scale < 4) break;
+        for (; i < count; ++i, out += scale)
+        {
+            const uint32x4_t v = vdupq_n_u32(in[i]);
+            int k = 0;
+            for (; k + 4 <= scale; k += 4) vst1q_u32(out + k, v);
+            for (; k < scale; ++k) out[k] = in[i];
+        }
+        break;
+#endif
+    }
+
+    // Whatever is left (or everything, without SIMD)
+    for (; i < count; ++i)
+        for (int k = 0; k < scale; ++k) *out++ = in[i];
+}
+
+// Copies the [left, right) x [top, bottom) part of a Width x Height surface into the same
+// place on a surface that is "scale" times bigger in each direction.  Each row is widened
+// once, and then that wider row is copied for the rest of its scale - 1 rows.
+[[maybe_unused]] static void imm2d_Upscale(const uint32_t *source, uint32_t *destination, int scale, int left, int top, int right, int bottom)
+{
+    const size_t stride = size_t(Width) * scale;
+    const size_t bytes = size_t(right - left) * scale * sizeof(uint32_t);
+
+    for (int y = top; y < bottom; ++y)
+    {
+        uint32_t *out = destination + size_t(y) * scale * stride + size_t(left) * scale;
+        imm2d_WidenRow(source + size_t(y) * Width + left, right - left, out, scale);
+
+        for (int copy = 1; copy < scale; ++copy) std::memcpy(out + copy * stride, out, bytes);
+    }
+}
+
+#ifndef IMM2D_HEADLESS
+
 static LRESULT CALLBACK imm2d_WndProc(HWND wnd, UINT msg, WPARAM w, LPARAM l)
 {
     static HDC bitmapDC{};
     static HBITMAP hbitmap{};
+    static uint32_t *scaled{};
 
     switch (msg)
     {
@@ -1292,28 +5290,71 @@ static LRESULT CALLBACK imm2d_WndProc(HWND wnd, UINT msg, WPARAM w, LPARAM l)
 
     case WM_PAINT:
     {
+        // Only the parts of the window that changed (or were uncovered) need to be converted and
+        // scaled.  Windows keeps track of those as a list of rectangles, which we ask for first.
+        static std::vector<char> regionData;
+        static std::vector<RECT> parts;
+        parts.clear();
+
+        HRGN region = CreateRectRgn(0, 0, 0, 0);
+        if (GetUpdateRgn(wnd, region, FALSE) > NULLREGION)
+        {
+            regionData.resize(GetRegionData(region, 0, nullptr));
+            auto *data = reinterpret_cast<RGNDATA *>(regionData.data());
+            if (!regionData.empty() && GetRegionData(region, DWORD(regionData.size()), data))
+            {
+                const RECT *rects = reinterpret_cast<const RECT *>(data->Buffer);
+                parts.assign(rects, rects + data->rdh.nCount);
+            }
+        }
+        DeleteObject(region);
+
         PAINTSTRUCT ps;
         HDC hdc = BeginPaint(wnd, &ps);
 
-        // A scaled GDI+ blit (even with nearest neighbor interpolation) is much slower than a plain
-        // Win32 StretchBlt.  Even with the extra 1:1 copy to a GDI surface first, it's still faster.
+        // Past a certain point, lots of little pieces cost more than their bounding box
+        if (parts.empty() || parts.size() > 32) parts.assign(1, ps.rcPaint);
+
+        // From window coordinates to (whole) pixels on our drawing surface
+        for (auto &p : parts)
+            p = { std::max(0L, p.left / PixelScale), std::max(0L, p.top / PixelScale),
+                  std::min<LONG>(Width, (p.right + PixelScale - 1) / PixelScale), std::min<LONG>(Height, (p.bottom + PixelScale - 1) / PixelScale) };
+
+        // We scale our pixels up ourselves, right into the memory of a window-sized bitmap, and
+        // then only have to ask Windows for a plain 1:1 blit.  (A scaled GDI+ blit, even with
+        // nearest neighbor interpolation, is very slow.  StretchBlt is better, but not by enough.)
         if (!hbitmap)
         {
+            BITMAPINFO info{};
+            info.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+            info.bmiHeader.biWidth = Width * PixelScale;
+            info.bmiHeader.biHeight = -Height * PixelScale; // Negative means top-down, just like ours
+            info.bmiHeader.biPlanes = 1;
+            info.bmiHeader.biBitCount = 32;
+            info.bmiHeader.biCompression = BI_RGB;
+
             bitmapDC = CreateCompatibleDC(hdc);
-            hbitmap = CreateCompatibleBitmap(hdc, Width, Height);
+            hbitmap = CreateDIBSection(hdc, &info, DIB_RGB_COLORS, reinterpret_cast<void **>(&scaled), nullptr, 0);
         }
 
-        HANDLE old = SelectObject(bitmapDC, hbitmap);
+        // Make sure GDI is done with the bitmap before we write to its memory
+        GdiFlush();
 
         {
             std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
-            Gdiplus::Graphics hdcG(bitmapDC);
 
-            hdcG.SetInterpolationMode(Gdiplus::InterpolationModeNearestNeighbor);
-            hdcG.DrawImage(imm2d_doubleBuffered ? imm2d_bitmapOther.get() : imm2d_bitmap.get(), 0, 0, 0, 0, Width, Height, Gdiplus::UnitPixel);
+            const auto &visible = imm2d_doubleBuffered ? imm2d_pixelsOther : imm2d_pixels;
+            if (!visible.empty() && scaled)
+                for (const auto &p : parts)
+                    if (p.right > p.left && p.bottom > p.top) imm2d_Upscale(visible.data(), scaled, PixelScale, p.left, p.top, p.right, p.bottom);
         }
 
-        StretchBlt(hdc, 0, 0, Width * PixelScale, Height * PixelScale, bitmapDC, 0, 0, Width, Height, SRCCOPY);
+        HANDLE old = SelectObject(bitmapDC, hbitmap);
+        for (const auto &p : parts)
+        {
+            if (p.right <= p.left || p.bottom <= p.top) continue;
+            BitBlt(hdc, p.left * PixelScale, p.top * PixelScale, (p.right - p.left) * PixelScale, (p.bottom - p.top) * PixelScale, bitmapDC, p.left * PixelScale, p.top * PixelScale, SRCCOPY);
+        }
         SelectObject(bitmapDC, old);
 
         EndPaint(wnd, &ps);
@@ -1382,58 +5423,81 @@ int WINAPI WinMain(_In_ HINSTANCE instance, _In_opt_ HINSTANCE, _In_ LPSTR, _In_
     Gdiplus::GdiplusStartupInput gdiplusStartupInput;
     GdiplusStartup(&gdiPlusToken, &gdiplusStartupInput, NULL);
 
-    imm2d_bitmap = std::make_unique<Gdiplus::Bitmap>(Width, Height);
-    imm2d_bitmapOther = std::make_unique<Gdiplus::Bitmap>(Width, Height);
-    imm2d_graphics = std::make_unique<Gdiplus::Graphics>(imm2d_bitmap.get());
-    imm2d_graphicsOther = std::make_unique<Gdiplus::Graphics>(imm2d_bitmapOther.get());
+    imm2d_pixels.assign(size_t(Width) * Height, Black);
+    imm2d_pixelsOther.assign(size_t(Width) * Height, Black);
+
+    imm2d_Rewrap(imm2d_pixels, imm2d_bitmap, imm2d_graphics);
+    imm2d_Rewrap(imm2d_pixelsOther, imm2d_bitmapOther, imm2d_graphicsOther);
     StopAntiAliasing();
     Clear();
 
     ShowWindow(wnd, cmdShow);
     UpdateWindow(wnd);
 
+    imm2d_wakeEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+
     HANDLE musicThread = CreateThread(nullptr, 0, imm2d_musicThreadProc, nullptr, 0, nullptr);
     CreateThread(nullptr, 0, imm2d_threadProc, nullptr, 0, nullptr);
 
-    const auto firstDraw = GetTickCount64();
-    auto lastDraw = firstDraw;
-
     MSG message;
-    while (true)
+    bool running = true;
+    while (running)
     {
-        if (PeekMessage(&message, nullptr, 0, 0, PM_REMOVE))
+        DWORD timeout = INFINITE;
         {
-            if (message.message == WM_QUIT) break;
-            TranslateMessage(&message);
-            DispatchMessage(&message);
+            std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+            imm2d_FlushPixelBox();
+
+            const auto now = Imm2dRepaintSchedule::Clock::now();
+            const auto wait = imm2d_repaint.untilRepaint(now);
+            if (wait == Imm2dRepaintSchedule::Clock::duration::zero())
+            {
+                for (int i = 0; i < imm2d_frontDirty.count; ++i)
+                {
+                    const auto &d = imm2d_frontDirty.rects[i];
+                    const RECT r{ d.left * PixelScale, d.top * PixelScale, d.right * PixelScale, d.bottom * PixelScale };
+                    InvalidateRect(wnd, &r, FALSE);
+                }
+                imm2d_frontDirty.clear();
+                imm2d_repaint.repainted(now);
+            }
+            else if (wait != Imm2dRepaintSchedule::Clock::duration::max())
+                timeout = static_cast<DWORD>(std::chrono::ceil<std::chrono::milliseconds>(wait).count());
         }
 
-        if (imm2d_quitting.exchange(false)) PostQuitMessage(0);
+        // Sleep until there's a window message, the drawing thread has something new to show
+        // (or wants to quit), or it's time for a repaint we had to hold off on
+        MsgWaitForMultipleObjects(1, &imm2d_wakeEvent, FALSE, timeout, QS_ALLINPUT);
 
-        const auto now = GetTickCount64();
-        imm2d_runDuration = now - firstDraw;
+        if (imm2d_quitting.exchange(false)) PostQuitMessage(0);
 
-        if (now - lastDraw > 5)
+        while (PeekMessage(&message, nullptr, 0, 0, PM_REMOVE))
         {
-            std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
-            if (imm2d_dirty) InvalidateRect(wnd, nullptr, FALSE);
-            imm2d_dirty = false;
-
-            lastDraw = now;
+            if (message.message == WM_QUIT) { running = false; break; }
+            TranslateMessage(&message);
+            DispatchMessage(&message);
         }
-        else ::Sleep(1);
     }
 
+    imm2d_StopLoaders();
+
     {
         std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+        imm2d_ClearTextCache();
+        imm2d_glyphFaces.clear();
+        imm2d_typographic.reset();
         imm2d_fonts.clear();
         imm2d_graphicsOther.reset();
         imm2d_graphics.reset();
         imm2d_bitmapOther.reset();
         imm2d_bitmap.reset();
+        imm2d_pixelsOther.clear();
+        imm2d_pixels.clear();
 
         std::lock_guard<std::mutex> lock2(imm2d_mediaLock);
+        imm2d_imagesByName.clear();
         imm2d_images.clear();
+        imm2d_imageStates.clear();
 
         Gdiplus::GdiplusShutdown(gdiPlusToken);
 
@@ -1451,6 +5515,49 @@ int WINAPI WinMain(_In_ HINSTANCE instance, _In_opt_ HINSTANCE, _In_ LPSTR, _In_
     return (UINT)message.wParam;
 }
 
+#else
+
+int main()
+{
+    if constexpr (Width <= 0) { std::fprintf(stderr, "IMM2D_WIDTH must be greater than 0.\n"); return 1; }
+    if constexpr (Height <= 0) { std::fprintf(stderr, "IMM2D_HEIGHT must be greater than 0.\n"); return 1; }
+    if constexpr (PixelScale <= 0) { std::fprintf(stderr, "IMM2D_SCALE must be greater than 0.\n"); return 1; }
+
+    imm2d_pixels.assign(size_t(Width) * Height, Black);
+    imm2d_pixelsOther.assign(size_t(Width) * Height, Black);
+
+    // There's nothing to play music on, so PlayMusic will drop every note
+    imm2d_musicRunning = false;
+
+    // Returning from run() closes the "window", too
+    std::thread([] { run(); CloseWindow(); }).detach();
+
+    {
+        std::unique_lock<std::mutex> lock(imm2d_wakeLock);
+        imm2d_wake.wait(lock, [] { return imm2d_quitting.load(); });
+    }
+
+    imm2d_StopLoaders();
+
+    {
+        std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+        imm2d_pixelsOther.clear();
+        imm2d_pixels.clear();
+
+        std::lock_guard<std::mutex> lock2(imm2d_mediaLock);
+        imm2d_imagesByName.clear();
+        imm2d_images.clear();
+        imm2d_imageStates.clear();
+
+        // Like ExitProcess in the Win32 version, this ends the run() thread (if it's still going)
+        // without giving it the chance to touch anything that is being destroyed on the way out.
+        std::fflush(nullptr);
+        std::_Exit(0);
+    }
+}
+
+#endif
+
 #endif
 
 
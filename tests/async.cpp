@@ -0,0 +1,211 @@
+// LoadImageAsync and IsImageReady: polling until an image is ready, names that never load,
+// lots of threads asking for the same names at once, and loads still waiting in line when
+// the program ends.
+
+#include "test.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+
+static std::string ReadAll(const char *path)
+{
+    std::string contents;
+    CHECK(imm2d_ReadFile(path, contents));
+    return contents;
+}
+
+static void WriteAll(const std::string &path, const std::string &contents)
+{
+    FILE *f = std::fopen(path.c_str(), "wb");
+    CHECK(f != nullptr);
+    if (!f) return;
+    std::fwrite(contents.data(), 1, contents.size(), f);
+    std::fclose(f);
+}
+
+// Loading happens on the loader threads, so this gives them a moment
+template<typename Condition>
+static bool WaitFor(Condition condition)
+{
+    for (int tries = 0; tries < 5000; ++tries)
+    {
+        if (condition()) return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+}
+
+// Whether a loader thread is done with an image (whether it worked or not)
+static bool Settled(Image i)
+{
+    std::lock_guard<std::mutex> lock(imm2d_mediaLock);
+    return imm2d_imageStates[i] != Imm2dImageState::Loading;
+}
+
+static size_t HandleCount()
+{
+    std::lock_guard<std::mutex> lock(imm2d_mediaLock);
+    return imm2d_imageStates.size();
+}
+
+static void TestPolling()
+{
+    const Image smile = LoadImageAsync("../exampleData/littleGame/smile.gif");
+    CHECK(smile != InvalidImage);
+    CHECK(WaitFor([smile] { return IsImageReady(smile); }));
+    CHECK(ImageWidth(smile) == 10 && ImageHeight(smile) == 10);
+
+    // Asking again (either way) is the same image, already ready
+    CHECK(LoadImageAsync("../exampleData/littleGame/smile.gif") == smile);
+    CHECK(LoadImage("../exampleData/littleGame/smile.gif") == smile);
+    CHECK(IsImageReady(smile));
+
+    // A few started at once all finish
+    const char *names[] = { "../exampleData/littleGame/wall.gif", "../exampleData/littleGame/door.gif", "../exampleData/littleGame/coin.gif" };
+    Image images[3];
+    for (int k = 0; k < 3; ++k) images[k] = LoadImageAsync(names[k]);
+    for (const Image i : images) CHECK(WaitFor([i] { return IsImageReady(i); }));
+    CHECK(images[0] != images[1] && images[1] != images[2] && images[0] != images[2]);
+
+    CHECK(LoadImageAsync(nullptr) == InvalidImage);
+    CHECK(!IsImageReady(InvalidImage));
+    CHECK(!IsImageReady(1000000));
+}
+
+static void TestFailures()
+{
+    WriteAll("build/async_truncated.gif", ReadAll("../exampleData/littleGame/coin.gif").substr(0, 100));
+
+    for (const char *name : { "build/async_missing.gif", "build/async_truncated.gif", "not a file or Base64" })
+    {
+        const Image i = LoadImageAsync(name);
+        CHECK(i != InvalidImage);
+        CHECK(WaitFor([i] { return Settled(i); }));
+        CHECK(!IsImageReady(i));
+        CHECK(ImageWidth(i) == 0 && ImageHeight(i) == 0);
+
+        // The name isn't remembered, so LoadImage tries again (and says it didn't work)
+        CHECK(LoadImage(name) == InvalidImage);
+    }
+
+    // A failed load gives its handle back, so trying over and over doesn't use up more
+    const size_t handles = HandleCount();
+    for (int k = 0; k < 50; ++k)
+    {
+        const Image i = LoadImageAsync("build/async_missing.gif");
+        CHECK(WaitFor([i] { return Settled(i); }));
+    }
+    CHECK(HandleCount() <= handles + 1);
+}
+
+// Eight threads all loading the same names (in different orders, some waiting and some not)
+// get the same image for each one, and each name is only loaded once.  Names that don't
+// load come back InvalidImage for everyone waiting on them, even though their handles are
+// being given out again to the other names at the same time.
+static void TestSameNameRace()
+{
+    const std::string coin = ReadAll("../exampleData/littleGame/coin.gif");
+    const int names = 40, threads = 8;
+    for (int k = 0; k < names; ++k) WriteAll("build/async_" + std::to_string(k) + ".gif", coin);
+
+    const auto Name = [](int k) { return k % 4 == 3 ? "build/async_gone_" + std::to_string(k) + ".gif" : "build/async_" + std::to_string(k) + ".gif"; };
+
+    const CacheStats before = ImageCacheStats();
+    std::vector<std::vector<Image>> results(threads, std::vector<Image>(names, InvalidImage));
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([t, &results, &Name]
+        {
+            for (int n = 0; n < names; ++n)
+            {
+                const int k = (n * 7 + t * 13) % names;
+                const std::string name = Name(k);
+                results[t][k] = (n + t) % 2 ? LoadImage(name.c_str()) : LoadImageAsync(name.c_str());
+            }
+        });
+    }
+    for (auto &w : workers) w.join();
+
+    for (int k = 0; k < names; ++k)
+    {
+        if (k % 4 == 3)
+        {
+            for (int t = 0; t < threads; ++t)
+            {
+                // Only LoadImage's answer is certain: LoadImageAsync's handle may belong to
+                // something else by now
+                if ((k + t) % 2 == 0) continue;
+                CHECK(results[t][k] == InvalidImage);
+            }
+            continue;
+        }
+
+        const Image i = results[0][k];
+        CHECK(i != InvalidImage);
+        for (int t = 1; t < threads; ++t) CHECK(results[t][k] == i);
+        CHECK(WaitFor([i] { return IsImageReady(i); }));
+        CHECK(ImageWidth(i) == 10 && ImageHeight(i) == 10);
+    }
+
+    CHECK(ImageCacheStats().entries - before.entries == names - names / 4);
+}
+
+// A solid gray .bmp, big enough to keep a loader thread busy for a moment
+static std::string BigBmp(int size)
+{
+    const uint32_t rowBytes = uint32_t(size) * 3, fileBytes = 54 + rowBytes * size;
+    std::string bmp(fileBytes, char(0x80));
+    const auto put = [&bmp](size_t at, uint32_t v) { for (int i = 0; i < 4; ++i) bmp[at + i] = char(v >> (i * 8)); };
+    std::fill(bmp.begin(), bmp.begin() + 54, '\0');
+    bmp[0] = 'B'; bmp[1] = 'M';
+    put(2, fileBytes); put(10, 54); put(14, 40); put(18, uint32_t(size)); put(22, uint32_t(size));
+    bmp[26] = 1; bmp[28] = 24;
+    return bmp;
+}
+
+// Loads still waiting in line when the program ends are given up on: nothing is left
+// loading, and nothing new is started
+static void TestPendingAtExit()
+{
+    const int count = 8 * int(std::max(1u, std::thread::hardware_concurrency()));
+    const std::string big = BigBmp(512);
+    for (int k = 0; k < count; ++k) WriteAll("build/async_exit_" + std::to_string(k) + ".bmp", big);
+
+    std::vector<Image> pending;
+    for (int k = 0; k < count; ++k) pending.push_back(LoadImageAsync(("build/async_exit_" + std::to_string(k) + ".bmp").c_str()));
+
+    // This is what the library does on the way out, after run() is over
+    imm2d_StopLoaders();
+
+    int abandoned = 0;
+    {
+        std::lock_guard<std::mutex> lock(imm2d_mediaLock);
+        for (const Image i : pending)
+        {
+            const auto state = imm2d_imageStates[i];
+            CHECK(state == Imm2dImageState::Loaded || state == Imm2dImageState::Unloaded);
+            abandoned += state == Imm2dImageState::Unloaded;
+        }
+    }
+    std::printf("%d of %d loads given up on at exit\n", abandoned, count);
+
+    // Nobody is left to load anything, so these fail right away instead of waiting forever
+    CHECK(LoadImage("build/async_0.gif") != InvalidImage);
+    CHECK(LoadImage("../exampleData/littleGame/bugH.gif") == InvalidImage);
+
+    const Image late = LoadImageAsync("../exampleData/littleGame/bugV.gif");
+    CHECK(late == InvalidImage || (Settled(late) && !IsImageReady(late)));
+}
+
+void run()
+{
+    TestPolling();
+    TestFailures();
+    TestSameNameRace();
+    TestPendingAtExit();
+
+    FinishTest();
+}
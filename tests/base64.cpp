@@ -0,0 +1,122 @@
+// imm2d_DecodeBase64 (whose middle is done 16 or 64 characters at a time with SIMD)
+// against the simple one-character-at-a-time decoder it replaced.
+
+#include "test.h"
+
+#include <chrono>
+#include <string>
+
+static const char Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static std::string ReferenceDecode(const char *base64)
+{
+    std::vector<int> T(256, -1);
+    for (int i = 0; i < 64; i++) T[(unsigned char)Alphabet[i]] = i;
+
+    std::string decoded;
+    unsigned int val = 0;
+    int valb = -8;
+    while (*base64)
+    {
+        const char c = *(base64++);
+        const int lookup = T[(unsigned char)c];
+        if (lookup == -1)
+        {
+            if (c != '=') decoded.clear();
+            break;
+        }
+
+        val = (val << 6) + lookup, valb += 6;
+        if (valb >= 0) { decoded.push_back(char((val >> valb) & 0xFF)); valb -= 8; }
+    }
+
+    return decoded;
+}
+
+static std::string Encode(const std::string &bytes)
+{
+    std::string out;
+    for (size_t i = 0; i < bytes.size(); i += 3)
+    {
+        uint32_t v = uint32_t(uint8_t(bytes[i])) << 16;
+        if (i + 1 < bytes.size()) v |= uint32_t(uint8_t(bytes[i + 1])) << 8;
+        if (i + 2 < bytes.size()) v |= uint8_t(bytes[i + 2]);
+
+        out += Alphabet[(v >> 18) & 63];
+        out += Alphabet[(v >> 12) & 63];
+        out += i + 1 < bytes.size() ? Alphabet[(v >> 6) & 63] : '=';
+        out += i + 2 < bytes.size() ? Alphabet[v & 63] : '=';
+    }
+    return out;
+}
+
+static uint32_t seed = 1;
+static uint8_t RandomByte()
+{
+    seed = seed * 1664525u + 1013904223u;
+    return uint8_t(seed >> 24);
+}
+
+static bool Matches(const std::string &base64)
+{
+    const bool same = imm2d_DecodeBase64(base64.c_str()) == ReferenceDecode(base64.c_str());
+    if (!same) std::printf("  differs for \"%s\"\n", base64.c_str());
+    return same;
+}
+
+void run()
+{
+    // Every length from nothing up to past two of the biggest SIMD blocks, since each
+    // vector loop hands off to the plain loop at a different spot
+    for (size_t length = 0; length <= 140; ++length)
+    {
+        for (int round = 0; round < 20; ++round)
+        {
+            std::string text;
+            for (size_t i = 0; i < length; ++i) text += Alphabet[RandomByte() & 63];
+
+            CHECK(Matches(text));
+            CHECK(Matches(text + "="));
+            CHECK(Matches(text + "=="));
+
+            // Something that isn't Base64 at each spot (including bytes above 127, which
+            // are negative to SSE2's signed compares), and padding in the middle
+            for (size_t at = 0; at < length && length <= 33; ++at)
+            {
+                for (const char bad : { '=', '-', '_', ' ', '\n', '@', '[', '`', '{', '\x7F', '\x80', '\xC0', '\xFF' })
+                {
+                    std::string broken = text;
+                    broken[at] = bad;
+                    CHECK(Matches(broken));
+                }
+            }
+        }
+    }
+
+    // And real, correctly padded Base64 comes back exactly
+    for (size_t length = 0; length <= 100; ++length)
+    {
+        std::string bytes;
+        for (size_t i = 0; i < length; ++i) bytes += char(RandomByte());
+        CHECK(imm2d_DecodeBase64(Encode(bytes).c_str()) == bytes);
+    }
+
+    // How long a big embedded picture takes both ways
+    std::string bytes;
+    for (size_t i = 0; i < 3 * 1024 * 1024; ++i) bytes += char(RandomByte());
+    const std::string base64 = Encode(bytes);
+
+    const int repeats = 5;
+    const auto Time = [&](std::string (*decode)(const char *))
+    {
+        const auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeats; ++r) CHECK(decode(base64.c_str()) == bytes);
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / repeats;
+    };
+
+    const double before = Time(ReferenceDecode), after = Time(imm2d_DecodeBase64);
+    std::printf("%.1f MB of Base64: %.2f ms one character at a time, %.2f ms now (%.1fx)\n",
+        base64.size() / 1e6, before, after, before / after);
+
+    FinishTest();
+}
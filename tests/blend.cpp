@@ -0,0 +1,121 @@
+// Both imm2d_BlendPixels (one color onto a row, and a row of colors onto a row) against
+// blending each pixel on its own with imm2d_Blend.  Their vector paths only run when every
+// pixel in a group is solid, so the rows here mix solid and see-through pixels, too.
+
+#include "test.h"
+
+static uint32_t seed = 1;
+static uint32_t Random()
+{
+    seed = seed * 1664525u + 1013904223u;
+    return seed;
+}
+
+static uint32_t RandomAlpha(int kind)
+{
+    switch (kind)
+    {
+    case 0: return 255;                                         // all solid (the vector path)
+    case 1: return Random() >> 24;                              // anything at all
+    case 2: return Random() % 5 == 0 ? Random() >> 24 : 255;    // solid, with a few that aren't
+    default: return (Random() >> 24) & 1 ? 255 : 0;             // only solid or invisible
+    }
+}
+
+static uint32_t RandomPixel(int kind) { return (Random() >> 8) | (RandomAlpha(kind) << 24); }
+
+static const uint32_t Guard = 0x12345678;
+
+// Blends into row[offset...offset + count), with guard values on both sides, and checks
+// the result (and the guards) against doing the same thing one pixel at a time
+static bool Same(std::vector<uint32_t> row, size_t offset, size_t count, const std::vector<uint32_t> &expected)
+{
+    for (size_t i = 0; i < row.size(); ++i)
+    {
+        const bool inside = i >= offset && i < offset + count;
+        if (row[i] != (inside ? expected[i - offset] : Guard)) return false;
+    }
+    return true;
+}
+
+static void CheckOneColor(const std::vector<uint32_t> &destination, size_t offset, Color c)
+{
+    std::vector<uint32_t> row(destination.size() + offset + 5, Guard), expected = destination;
+    std::copy(destination.begin(), destination.end(), row.begin() + offset);
+    for (auto &p : expected) p = imm2d_Blend(p, c);
+
+    imm2d_BlendPixels(row.data() + offset, destination.size(), c);
+    const bool same = Same(row, offset, destination.size(), expected);
+    if (!same) std::printf("  %zu pixels at +%zu, color %08X\n", destination.size(), offset, unsigned(c));
+    CHECK(same);
+}
+
+static void CheckColors(const std::vector<uint32_t> &destination, size_t offset, const std::vector<Color> &colors)
+{
+    std::vector<uint32_t> row(destination.size() + offset + 5, Guard), expected = destination;
+    std::copy(destination.begin(), destination.end(), row.begin() + offset);
+    for (size_t i = 0; i < expected.size(); ++i) expected[i] = imm2d_Blend(expected[i], colors[i]);
+
+    imm2d_BlendPixels(row.data() + offset, colors.data(), colors.size());
+    const bool same = Same(row, offset, destination.size(), expected);
+    if (!same) std::printf("  %zu colors at +%zu\n", colors.size(), offset);
+    CHECK(same);
+}
+
+void run()
+{
+    // Every source alpha onto every destination alpha (eight in a row, so it's one or two
+    // vector groups), both ways
+    for (uint32_t sa = 0; sa < 256; ++sa)
+    {
+        for (uint32_t da = 0; da < 256; ++da)
+        {
+            std::vector<uint32_t> destination(8);
+            for (auto &p : destination) p = (Random() >> 8) | (da << 24);
+            const Color c = (Random() >> 8) | (sa << 24);
+            CheckOneColor(destination, 0, c);
+
+            std::vector<Color> colors(8);
+            for (auto &color : colors) color = (Random() >> 8) | (sa << 24);
+            CheckColors(destination, 0, colors);
+        }
+    }
+
+    // Every length up to a few groups past the widest vector, starting anywhere, with every
+    // mix of solid and see-through pixels on both sides
+    for (size_t count = 0; count <= 20; ++count)
+    {
+        for (size_t offset = 0; offset < 8; ++offset)
+        {
+            for (int round = 0; round < 40; ++round)
+            {
+                const int destinationKind = round % 4, colorKind = (round / 4) % 4;
+
+                std::vector<uint32_t> destination(count);
+                for (auto &p : destination) p = RandomPixel(destinationKind);
+                CheckOneColor(destination, offset, RandomPixel(1));
+                CheckOneColor(destination, offset, RandomPixel(colorKind));
+
+                std::vector<Color> colors(count);
+                for (auto &color : colors) color = RandomPixel(colorKind);
+                CheckColors(destination, offset, colors);
+            }
+        }
+    }
+
+    // And a long row, with solid and see-through stretches
+    std::vector<uint32_t> destination(1000);
+    std::vector<Color> colors(1000);
+    for (size_t i = 0; i < destination.size(); ++i)
+    {
+        destination[i] = RandomPixel(int(i / 37) % 4);
+        colors[i] = RandomPixel(int(i / 23) % 4);
+    }
+    for (size_t offset = 0; offset < 4; ++offset)
+    {
+        CheckOneColor(destination, offset, MakeColor(10, 200, 30, 99));
+        CheckColors(destination, offset, colors);
+    }
+
+    FinishTest();
+}
@@ -0,0 +1,139 @@
+// The image memory budget: images that get let go once it's used up, and loaded
+// again (in the background) the next time they're drawn, even if their file has
+// changed in the meantime.
+
+#include "test.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+static const char *WallPath = "build/budget_wall.gif", *CoinPath = "build/budget_coin.gif";
+
+static std::string ReadAll(const char *path)
+{
+    std::string contents;
+    CHECK(imm2d_ReadFile(path, contents));
+    return contents;
+}
+
+static void WriteAll(const char *path, const std::string &contents)
+{
+    FILE *f = std::fopen(path, "wb");
+    CHECK(f != nullptr);
+    if (!f) return;
+    std::fwrite(contents.data(), 1, contents.size(), f);
+    std::fclose(f);
+}
+
+// A 1x1 .bmp of a single color
+static std::string TinyBmp(uint8_t red, uint8_t green, uint8_t blue)
+{
+    std::string bmp(58, '\0');
+    const auto put = [&bmp](size_t at, uint32_t v) { for (int i = 0; i < 4; ++i) bmp[at + i] = char(v >> (i * 8)); };
+    bmp[0] = 'B'; bmp[1] = 'M';
+    put(2, 58); put(10, 54); put(14, 40); put(18, 1); put(22, 1);
+    bmp[26] = 1; bmp[28] = 24;
+    bmp[54] = char(blue); bmp[55] = char(green); bmp[56] = char(red);
+    return bmp;
+}
+
+// Reloading happens on the loader threads, so this gives them a moment
+template<typename Condition>
+static bool WaitFor(Condition condition)
+{
+    for (int tries = 0; tries < 5000; ++tries)
+    {
+        if (condition()) return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+}
+
+// Draws an image that was let go, and waits for it to come back
+static bool DrawUntilLoaded(Image i)
+{
+    DrawImage(0, 0, i);
+    return WaitFor([i] { return ImageMemoryUsage(i) > 0; });
+}
+
+static std::vector<uint32_t> DrawAlone(Image i)
+{
+    Clear();
+    DrawImage(0, 0, i);
+    return CopyScreen();
+}
+
+void run()
+{
+    const std::string wallFile = ReadAll("../exampleData/littleGame/wall.gif");
+    const std::string coinFile = ReadAll("../exampleData/littleGame/coin.gif");
+    WriteAll(WallPath, wallFile);
+    WriteAll(CoinPath, coinFile);
+
+    const Image wall = LoadImage(WallPath), coin = LoadImage(CoinPath);
+    CHECK(wall != InvalidImage && coin != InvalidImage);
+    CHECK(ImageMemoryUsage(wall) == 10 * 10 * 4);
+    CHECK(ImageMemoryUsage(coin) == 10 * 10 * 6 * 4);
+    const auto wallPixels = DrawAlone(wall);
+
+    // A budget smaller than anything lets everything go, but the images are still good
+    // to use (and still know their sizes)
+    SetImageMemoryBudget(1);
+    CHECK(ImageMemoryUsage(InvalidImage) == 0);
+    CHECK(IsImageReady(wall) && ImageWidth(wall) == 10 && ImageHeight(wall) == 10);
+
+    // Drawing one skips it this time and brings it back for the next
+    CHECK(DrawAlone(wall) != wallPixels);
+    CHECK(LoadImage(WallPath) == wall);
+    CHECK(DrawUntilLoaded(wall));
+    CHECK(DrawAlone(wall) == wallPixels);
+
+    // Only the image drawn most recently fits
+    CHECK(DrawUntilLoaded(coin));
+    CHECK(ImageMemoryUsage(wall) == 0);
+    CHECK(ImageMemoryUsage(InvalidImage) == ImageMemoryUsage(coin));
+
+    // If its file is gone, it stays let go (and ready) until the file comes back
+    std::remove(WallPath);
+    DrawImage(0, 0, wall);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    CHECK(ImageMemoryUsage(wall) == 0 && IsImageReady(wall));
+
+    WriteAll(WallPath, wallFile);
+    CHECK(DrawUntilLoaded(wall));
+    CHECK(DrawAlone(wall) == wallPixels);
+
+    // A file that changed while its image was let go comes back at its new size, with
+    // its new frames.  (Drawing it at the old size would read past the new pixels.)
+    CHECK(DrawUntilLoaded(coin));
+    WriteAll(WallPath, TinyBmp(10, 20, 30));
+    CHECK(DrawUntilLoaded(wall));
+    CHECK(ImageWidth(wall) == 1 && ImageHeight(wall) == 1);
+
+    const auto tiny = DrawAlone(wall);
+    CHECK(tiny[0] == MakeColor(10, 20, 30) && tiny[1] == Black && tiny[Width] == Black);
+
+    CHECK(DrawUntilLoaded(coin));
+    WriteAll(WallPath, coinFile);
+    CHECK(DrawUntilLoaded(wall));
+    CHECK(ImageWidth(wall) == 10 && ImageMemoryUsage(wall) == 10 * 10 * 6 * 4);
+    for (int frame = 0; frame < 20; ++frame)
+    {
+        DrawImage(0, 0, wall);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+
+    // Without a budget, nothing is let go any more
+    SetImageMemoryBudget(0);
+    CHECK(DrawUntilLoaded(coin));
+    CHECK(ImageMemoryUsage(wall) > 0 && ImageMemoryUsage(coin) > 0);
+
+    UnloadImage(wall);
+    UnloadImage(coin);
+    CHECK(ImageMemoryUsage(InvalidImage) == 0);
+
+    std::remove(WallPath);
+    std::remove(CoinPath);
+    FinishTest();
+}
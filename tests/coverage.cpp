@@ -0,0 +1,162 @@
+// Smoothed (anti-aliased) shapes, compared with a much simpler (and much slower)
+// rasterizer that counts how many of 16x16 points in each pixel are inside the shape.
+// They also share one coverage buffer, so nothing one shape leaves behind in it may
+// show up in the next.
+
+#include "test.h"
+
+// Draws a shape in white on black, then compares each pixel with the fraction of its
+// sample points that "inside" says are in the shape.  Returns the biggest difference
+// (out of 255), and adds up all of them in totalError.
+template<typename Draw, typename Inside>
+static int CompareWithReference(Draw draw, Inside inside, double &totalError)
+{
+    Clear();
+    draw();
+    const auto screen = CopyScreen();
+
+    int worst = 0;
+    for (int y = 0; y < Height; ++y)
+    {
+        for (int x = 0; x < Width; ++x)
+        {
+            int count = 0;
+            for (int sy = 0; sy < 16; ++sy)
+                for (int sx = 0; sx < 16; ++sx)
+                    count += inside(x + (sx + 0.5f) / 16, y + (sy + 0.5f) / 16);
+
+            const int expected = (count * 255 + 128) / 256;
+            const int actual = int(screen[size_t(y) * Width + x] & 0xFF);
+            worst = std::max(worst, std::abs(actual - expected));
+            totalError += std::abs(actual - expected);
+        }
+    }
+    return worst;
+}
+
+static float DistanceToSegment(float px, float py, float x1, float y1, float x2, float y2)
+{
+    const float dx = x2 - x1, dy = y2 - y1, lengthSquared = dx * dx + dy * dy;
+    const float t = lengthSquared > 0 ? std::max(0.0f, std::min(1.0f, ((px - x1) * dx + (py - y1) * dy) / lengthSquared)) : 0;
+    return std::hypot(px - (x1 + t * dx), py - (y1 + t * dy));
+}
+
+static void TestAgainstReference()
+{
+    // Curves are drawn as straight pieces up to a tenth of a pixel away (which is up to
+    // 26 out of 255 for a pixel along that edge) and the 16x16 points can be off by about
+    // a sixteenth of their own, so single pixels may be off by that much.  On average,
+    // though, it should be very close.
+    static constexpr int MostAllowed = 40;
+    static constexpr double AverageAllowed = 0.1;
+
+    double totalError = 0;
+    int shapes = 0;
+    for (int i = 0; i < 40; ++i)
+    {
+        const float cx = 20 + (i * 37) % 60 + i * 0.37f, cy = 20 + (i * 23) % 40 + i * 0.19f;
+        const float radius = 0.6f + i * 0.9f;
+
+        // Fills are centered right where they say.  (Passing the stroke picks the version
+        // of DrawCircle that takes fractions.)
+        CHECK(CompareWithReference(
+            [&] { DrawCircle(cx, cy, radius, White, Transparent); },
+            [&](float x, float y) { return std::hypot(x - cx, y - cy) <= radius; }, totalError) <= MostAllowed);
+
+        // Strokes are a pixel wide, centered on the middle of the pixel at (x, y)
+        const int x = int(cx), y = int(cy), r = int(radius) + 1;
+        CHECK(CompareWithReference(
+            [&] { DrawCircle(x, y, r, Transparent, White); },
+            [&](float px, float py) { return std::fabs(std::hypot(px - x - 0.5f, py - y - 0.5f) - r) <= 0.5f; }, totalError) <= MostAllowed);
+
+        const int x2 = x + int(radius * 3) - 30, y2 = y + (i % 5) * 7 - 12, thickness = 1 + i % 7;
+        CHECK(CompareWithReference(
+            [&] { DrawLine(x, y, x2, y2, thickness, White); },
+            [&](float px, float py) { return DistanceToSegment(px, py, x + 0.5f, y + 0.5f, x2 + 0.5f, y2 + 0.5f) <= thickness / 2.0f; }, totalError) <= MostAllowed);
+
+        // Arcs are round-capped pieces of a ring (with screen angles upside-down from these)
+        const float start = i * 0.4f, end = start + 0.3f + (i % 9) * 0.6f, half = 1.0f + i % 4;
+        CHECK(CompareWithReference(
+            [&] { DrawArc(x, y, radius + 2, half * 2, White, start, end); },
+            [&](float px, float py) {
+                const float dx = px - x - 0.5f, dy = py - y - 0.5f;
+                float angle = -std::atan2(dy, dx);
+                while (angle < start) angle += float(Tau);
+                if (angle <= end && std::fabs(std::hypot(dx, dy) - (radius + 2)) <= half) return true;
+                for (const float a : { start, end })
+                    if (std::hypot(dx - (radius + 2) * std::cos(a), dy + (radius + 2) * std::sin(a)) <= half) return true;
+                return false;
+            }, totalError) <= MostAllowed);
+
+        shapes += 4;
+    }
+
+    const double average = totalError / (double(shapes) * Width * Height);
+    std::printf("average difference from the reference: %.4f\n", average);
+    CHECK(average <= AverageAllowed);
+}
+
+static bool CoverageIsEmpty()
+{
+    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+    for (const float cell : imm2d_coverage.cells) if (cell != 0) return false;
+    return true;
+}
+
+// Draws 'second' on a cleared screen, with and without 'first' drawn just
+// before it (and then painted over), and makes sure they come out the same.
+template<typename First, typename Second>
+static bool SameAfter(First first, Second second)
+{
+    Clear();
+    second();
+    const auto alone = CopyScreen();
+
+    Clear();
+    first();
+    CHECK(CoverageIsEmpty());
+    Clear();
+    second();
+    return CopyScreen() == alone;
+}
+
+void run()
+{
+    UseAntiAliasing();
+    TestAgainstReference();
+
+    // A shape that's completely past the right side only touches the spare cells at the
+    // end of each row.  Its edges should cancel out there, but (with these heights) the
+    // rounding doesn't quite, and whatever is left over has to be cleared all the same.
+    {
+        std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+        auto &g = imm2d_coverage;
+        if (g.begin(float(Width - 10), 0, float(Width + 10), 1))
+        {
+            g.moveTo(Width + 5.0f, 0.1f);
+            g.lineTo(Width + 8.0f, 0.2f);
+            g.lineTo(Width + 3.0f, 0.7f);
+            g.fill(Red);
+        }
+    }
+    CHECK(CoverageIsEmpty());
+
+    // A wide shape running off the right side of the screen, then a narrow one
+    for (int y = 0; y < Height; y += 7)
+    {
+        CHECK(SameAfter(
+            [&] { DrawLine(Width - 20, y, Width + 60, y + 40, 9, Red); },
+            [&] { DrawCircle(20.5f, 20.25f, 6.5f, White); }));
+
+        CHECK(SameAfter(
+            [&] { DrawCircle(float(Width - 3), float(y), 30.0f, Green, Blue); },
+            [&] { DrawLine(3.5f, 5.0f, 14.0f, 30.0f, 3, White); }));
+    }
+
+    // And a narrow shape followed by a wide one
+    CHECK(SameAfter(
+        [&] { DrawLine(Width - 2, 10, Width + 8, 30, 2, Red); },
+        [&] { DrawCircle(float(Width / 2), float(Height / 2), Height / 3.0f, White, Red); }));
+
+    FinishTest();
+}
@@ -0,0 +1,457 @@
+// The .gif, .png, and .bmp decoders, checked against pictures whose pixels were worked
+// out some other way, and against broken copies of them (which must never crash).
+
+#include "test.h"
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+
+// FNV-1a over every pixel, so a whole picture can be compared with one number
+static uint64_t Hash(const std::vector<uint32_t> &pixels)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (const uint32_t p : pixels) { h ^= p; h *= 0x100000001b3ull; }
+    return h;
+}
+
+static std::string ReadAll(const char *path)
+{
+    std::string contents;
+    CHECK(imm2d_ReadFile(path, contents));
+    return contents;
+}
+
+// Whatever a decoder makes of a broken file, it has to either fail or hand back a
+// picture that's the size it says it is
+static void CheckDamaged(const std::string &data)
+{
+    Imm2dDecodedImage image;
+    if (!imm2d_DecodeImage(data, image)) return;
+
+    const size_t frames = std::max<size_t>(1, image.frameCentiSeconds.size());
+    CHECK(imm2d_CheckImageSize(image.width, image.height, frames));
+    CHECK(image.pixels.size() == size_t(image.width) * image.height * frames);
+}
+
+static void CheckEveryDamagedCopy(const std::string &data)
+{
+    for (size_t length = 0; length < data.size(); ++length) CheckDamaged(data.substr(0, length));
+
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        for (const uint8_t flip : { 0x01, 0x10, 0x80, 0xFF })
+        {
+            std::string broken = data;
+            broken[i] = char(broken[i] ^ flip);
+            CheckDamaged(broken);
+        }
+    }
+}
+
+
+//
+// .gif
+//
+
+// The pixels were decoded by a separate (much slower) decoder written from the GIF spec
+struct GifCase { const char *name; int frames; uint32_t centiSeconds[10]; uint64_t hash; };
+static const GifCase Gifs[] =
+{
+    { "bugH.gif", 6, { 18, 18, 18, 18, 18, 18 }, 0x737854cffa7fe8e7ull },
+    { "bugV.gif", 6, { 18, 18, 18, 18, 18, 18 }, 0x7d778453dc848ef9ull },
+    { "coin.gif", 6, { 18, 18, 18, 18, 18, 18 }, 0x8f207b4b7616cac5ull },
+    { "door.gif", 1, { 0 }, 0x464a066058e6664bull },
+    { "smile.gif", 1, { 0 }, 0x44d487aa33b96975ull },
+    { "trigger.gif", 10, { 150, 25, 10, 25, 10, 25, 10, 25, 10, 15 }, 0x0e7b12406918f719ull },
+    { "wall.gif", 1, { 0 }, 0x692b48e66e326573ull },
+};
+
+// A plain LZW encoder, so there's something big enough to fill the whole 4096-entry code
+// table.  Encoders either start over with a "clear" code when the table fills up or just
+// stop adding to it, and the decoder has to handle both.
+static std::string EncodeLzw(const std::vector<uint8_t> &indexes, int minimumSize, bool clearWhenFull)
+{
+    const int clear = 1 << minimumSize, end = clear + 1;
+    std::string out;
+    uint32_t bits = 0;
+    int bitCount = 0, codeSize = minimumSize + 1, next = end + 1;
+
+    const auto write = [&](int code) {
+        bits |= uint32_t(code) << bitCount;
+        for (bitCount += codeSize; bitCount >= 8; bitCount -= 8) { out += char(bits & 0xFF); bits >>= 8; }
+    };
+
+    // Each table entry is a code already in the table plus one more index
+    std::vector<int> table(4096 * 256, -1);
+    write(clear);
+
+    int current = indexes[0];
+    for (size_t i = 1; i < indexes.size(); ++i)
+    {
+        int &entry = table[size_t(current) * 256 + indexes[i]];
+        if (entry >= 0) { current = entry; continue; }
+
+        write(current);
+        if (next < 4096)
+        {
+            entry = next++;
+            if (next > (1 << codeSize)) ++codeSize;
+        }
+        else if (clearWhenFull)
+        {
+            write(clear);
+            std::fill(table.begin(), table.end(), -1);
+            codeSize = minimumSize + 1;
+            next = end + 1;
+        }
+        current = indexes[i];
+    }
+
+    write(current);
+    write(end);
+    if (bitCount > 0) out += char(bits & 0xFF);
+    return out;
+}
+
+static std::string MakeGif(int width, int height, const std::vector<uint8_t> &indexes, bool clearWhenFull)
+{
+    std::string gif = "GIF89a";
+    const auto put16 = [&gif](int v) { gif += char(v & 0xFF); gif += char(v >> 8); };
+
+    put16(width); put16(height);
+    gif += char(0xF7); gif += '\0'; gif += '\0';
+    for (int i = 0; i < 256; ++i) { gif += char(i); gif += char(255 - i); gif += char(i * 7); }
+
+    gif += ',';
+    put16(0); put16(0); put16(width); put16(height);
+    gif += '\0';
+    gif += char(8);
+
+    const std::string data = EncodeLzw(indexes, 8, clearWhenFull);
+    for (size_t p = 0; p < data.size(); p += 255)
+    {
+        const size_t length = std::min<size_t>(255, data.size() - p);
+        gif += char(length);
+        gif += data.substr(p, length);
+    }
+    gif += '\0';
+    gif += ';';
+    return gif;
+}
+
+static void TestGif()
+{
+    for (const auto &c : Gifs)
+    {
+        const std::string data = ReadAll(("../exampleData/littleGame/" + std::string(c.name)).c_str());
+
+        Imm2dDecodedImage image;
+        CHECK(imm2d_DecodeGif(data, image));
+        CHECK(image.width == 10 && image.height == 10);
+        CHECK(image.frameCentiSeconds == std::vector<uint32_t>(c.centiSeconds, c.centiSeconds + c.frames));
+        CHECK(Hash(image.pixels) == c.hash);
+
+        CheckEveryDamagedCopy(data);
+    }
+
+    // Mostly-random pixels, with just enough runs in them to make long codes
+    const int width = 150, height = 120;
+    std::vector<uint8_t> indexes(size_t(width) * height);
+    uint32_t seed = 1;
+    for (auto &index : indexes)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        index = (seed >> 28) < 4 ? uint8_t(seed >> 20) : uint8_t((seed >> 24) & 3);
+    }
+
+    for (const bool clearWhenFull : { true, false })
+    {
+        Imm2dDecodedImage image;
+        CHECK(imm2d_DecodeGif(MakeGif(width, height, indexes, clearWhenFull), image));
+        CHECK(image.width == width && image.height == height);
+        CHECK(image.pixels.size() == indexes.size());
+
+        bool same = image.pixels.size() == indexes.size();
+        for (size_t i = 0; same && i < indexes.size(); ++i)
+        {
+            const uint32_t index = indexes[i];
+            same = image.pixels[i] == (0xFF000000 | (index << 16) | ((255 - index) << 8) | ((index * 7) & 0xFF));
+        }
+        CHECK(same);
+    }
+}
+
+
+//
+// .png
+//
+
+// Each of these was made from a known picture by a separate encoder (using zlib), with
+// every filter type mixed in.  Between them they cover each color type and bit depth,
+// see-through colors, interlacing, and all three kinds of deflate block.
+struct PngCase { int width, height; uint64_t hash; const char *data; size_t size; };
+#define PNG_CASE(width, height, hash, data) { width, height, hash, data, sizeof(data) - 1 }
+static const PngCase Pngs[] =
+{
+    // Gray 1-bit, interlaced
+    PNG_CASE(13, 9, 0x51803778ab15d929ull,
+        "\x89\x50\x4e\x47\x0d\x0a\x1a\x0a\x00\x00\x00\x0d\x49\x48\x44\x52\x00\x00\x00\x0d\x00\x00\x00\x09"
+        "\x01\x00\x00\x00\x01\xb6\x06\xab\x51\x00\x00\x00\x11\x49\x44\x41\x54\x78\xda\x63\x6a\x60\x68\x60"
+        "\x74\x60\x56\x60\x39\xc0\x74\x80\xe5\x01\xce\xef\x5b\x12\x00\x00\x00\x11\x49\x44\x41\x54\x4b\x03"
+        "\xd3\x02\xc6\x37\x2c\x0d\x2c\x0c\x0c\x3f\x98\x0d\x58\xae\x30\x42\x7e\x52\xe3\x00\x00\x00\x11\x49"
+        "\x44\x41\x54\x0b\xbc\x60\xfe\xbe\x90\xb9\xee\x1c\xf3\xd4\xc5\x00\xfb\xb0\x0d\x8f\x6b\xae\x43\x55"
+        "\x00\x00\x00\x00\x49\x45\x4e\x44\xae\x42\x60\x82"),
+    // Gray 16-bit, see-through gray
+    PNG_CASE(7, 5, 0x7a9cf38909d67fc2ull,
+        "\x89\x50\x4e\x47\x0d\x0a\x1a\x0a\x00\x00\x00\x0d\x49\x48\x44\x52\x00\x00\x00\x07\x00\x00\x00\x05"
+        "\x10\x00\x00\x00\x00\xfc\x61\x75\x47\x00\x00\x00\x02\x74\x52\x4e\x53\x0d\x0e\x24\x85\x9e\x72\x00"
+        "\x00\x00\x19\x49\x44\x41\x54\x78\x01\x63\x30\x65\x02\x41\xf9\x7b\x89\xd3\x95\xaa\xb3\x1e\x33\xad"
+        "\x99\x0e\x82\xfd\xb6\x3b\x43\x84\xde\xb4\x5e\x37\x00\x00\x00\x19\x49\x44\x41\x54\x3e\x4c\xb3\x66"
+        "\xca\xb9\x19\x14\x75\x73\x52\xfc\x67\x2e\x51\x33\xde\xac\x28\x66\xb5\xab\x4e\xcb\x45\x07\x5b\xea"
+        "\xe8\x00\x00\x00\x19\x49\x44\x41\x54\xb6\x44\xff\x6b\xee\x9a\xe0\xf1\xca\x9c\xf1\xe7\x93\xaf\x9b"
+        "\xd8\x13\x18\xc0\x20\xe4\x32\x00\x63\xc6\xa0\x44\x9d\x49\x00\x00\x00\x02\x49\x44\x41\x54\x1d\xf3"
+        "\xa7\x23\x72\x00\x00\x00\x00\x00\x49\x45\x4e\x44\xae\x42\x60\x82"),
+    // Rgb 8-bit, stored
+    PNG_CASE(6, 4, 0x996224c3c3606a01ull,
+        "\x89\x50\x4e\x47\x0d\x0a\x1a\x0a\x00\x00\x00\x0d\x49\x48\x44\x52\x00\x00\x00\x06\x00\x00\x00\x04"
+        "\x08\x02\x00\x00\x00\x22\x66\xd9\x14\x00\x00\x00\x1d\x49\x44\x41\x54\x78\x01\x01\x4c\x00\xb3\xff"
+        "\x01\x0b\x69\xb9\x00\x00\x00\x00\x00\x00\x4a\x4d\xb9\x53\xbc\xf1\xd2\x5b\x11\x01\x66\xfc\xf2\x21"
+        "\x5c\x82\x00\x00\x00\x1d\x49\x44\x41\x54\xb6\x00\x00\x00\x00\x00\x00\x4a\xe8\xfc\x0a\x45\xbe\x7a"
+        "\x4b\x80\x00\x64\xac\x68\xf7\x00\xf5\xb0\x2b\x3d\xc6\x66\xf4\x26\x8c\x20\xe3\x00\x00\x00\x1d\x49"
+        "\x44\x41\x54\x5b\xde\xaa\x2c\xca\xed\x02\x69\x7f\xe9\x60\x41\x19\x9d\xc3\x0d\x2c\x4d\x5b\xe8\x2c"
+        "\x5d\x08\x7d\xf1\x13\x59\x1e\x6d\x9f\x03\xd2\x15\x00\x00\x00\x00\x49\x45\x4e\x44\xae\x42\x60\x82"),
+    // Rgb 16-bit, interlaced
+    PNG_CASE(9, 7, 0x7917509b779f6246ull,
+        "\x89\x50\x4e\x47\x0d\x0a\x1a\x0a\x00\x00\x00\x0d\x49\x48\x44\x52\x00\x00\x00\x09\x00\x00\x00\x07"
+        "\x10\x02\x00\x00\x01\x72\x6e\x1c\xe2\x00\x00\x00\x06\x74\x52\x4e\x53\x87\xf8\x8b\x39\x14\x44\x5b"
+        "\xaa\x85\x94\x00\x00\x00\x7d\x49\x44\x41\x54\x78\xda\x63\xca\xf9\x38\xf5\x7f\xb5\xfa\x77\x0e\xb3"
+        "\x60\x59\x71\x46\xdf\xbd\x9c\x93\x1f\x46\x30\xc5\xde\xbf\x79\x58\x55\xb8\x35\x5d\xeb\x41\xe1\xfd"
+        "\x98\xfd\xe9\x7e\xf3\xf7\x32\x42\x94\xbd\xf1\xd9\x5c\x5d\xee\xc6\x00\x91\x11\x93\xaf\x12\xb1\xe0"
+        "\x62\x52\x2d\xc8\x79\x3a\x9b\xd5\xd3\xa4\x71\xba\x9b\xdb\xe9\x17\x3f\xab\x82\x23\x8b\xba\x82\x56"
+        "\xdf\xf9\x00\x21\x99\xe7\xef\x7a\x9a\xf6\xb5\xd4\x24\xfe\xac\xe2\x3f\xc9\x7d\x62\x3c\x49\x67\x0f"
+        "\x0a\x55\x16\xbc\xe8\xf0\xd3\x60\x7a\xb4\x71\xf1\x3e\x06\x88\xb9\xde\x1b\x8f\x86\x00\x00\x00\x7d"
+        "\x49\x44\x41\x54\xaf\xa6\x5c\x8f\x71\xfa\x1c\x7b\x80\x89\xd9\x67\x93\xed\x1c\xf9\x79\xcb\x9e\x33"
+        "\x73\xe8\xb0\x4e\xa9\xcb\x8c\xbe\x7f\xd7\x6c\x53\xd5\x99\xb7\x92\xc5\xf3\xea\xa5\xbf\x4b\xb1\x4b"
+        "\xb3\x32\x79\xf3\xec\xec\x2e\xba\x33\xed\xcd\xae\x62\xc7\x75\xc2\x77\x6f\x98\x4e\x7d\xff\x40\xde"
+        "\x24\xc7\xf6\x36\x8b\x86\x93\xb0\x95\xa8\x7c\xd5\xc4\x99\x4a\xf2\x55\x07\xfe\xcc\x7e\x72\xc0\x7f"
+        "\x76\x82\x49\x64\xff\x41\xc6\x7a\xab\xc4\x4f\xbd\x27\x18\x90\x80\x7a\x0d\xab\x1a\x83\xb2\xe3\xe3"
+        "\xbe\x95\x1f\x1f\xce\x0d\x28\xfe\x91\x79\xdf\xf5\x09\x00\x00\x00\x7d\x49\x44\x41\x54\x1e\x76\xc8"
+        "\x37\x6f\x46\xa4\x72\xd3\x5a\x5e\x9e\xe4\xe6\x58\xc7\x99\x37\xac\xda\x19\xd7\x72\xbf\xba\xf6\xb0"
+        "\x39\xc6\xfc\xd6\xa7\x13\xe6\x7d\xcc\x31\x4a\x13\x78\xef\x1d\x10\xdd\xfd\xc9\x59\xe8\x73\xd8\x94"
+        "\x97\x56\x57\xff\xfc\xb7\xd3\x13\x64\xc0\x00\x2c\xef\xe5\xea\x27\x6e\xfe\x74\xfb\xfd\xa7\x75\xdf"
+        "\x8e\x9f\xad\x7c\x69\xee\xbe\x53\x2a\xf5\x25\x03\x83\x01\xc3\xa6\x2b\xc2\x0c\xdf\xb4\x18\x18\xae"
+        "\x32\x7c\xf3\x39\x76\xe0\x9b\x6c\x74\xe1\x9e\x35\xee\x42\x0f\xbf\xb7\x5d\x62\x50\xd8\x07\x00\x52"
+        "\x63\xab\xb9\x2b\x87\xaa\x00\x00\x00\x01\x49\x44\x41\x54\xdb\x39\x39\x76\xb4\x00\x00\x00\x00\x49"
+        "\x45\x4e\x44\xae\x42\x60\x82"),
+    // Palette 4-bit, tRNS
+    PNG_CASE(11, 6, 0xa518c68059398089ull,
+        "\x89\x50\x4e\x47\x0d\x0a\x1a\x0a\x00\x00\x00\x0d\x49\x48\x44\x52\x00\x00\x00\x0b\x00\x00\x00\x06"
+        "\x04\x03\x00\x00\x00\xe7\x1c\x79\xcb\x00\x00\x00\x30\x50\x4c\x54\x45\x02\x2e\x87\x2d\x49\xcc\x15"
+        "\xc9\x0b\x99\x9b\x77\x2b\x4f\xc7\xa6\xfd\x4c\x91\x4a\x16\xdb\x47\x08\x75\x2b\x0f\x15\x44\xb8\x35"
+        "\xc0\xe7\x19\x09\x7d\xfa\x87\x01\xe9\x23\x2f\x21\xf2\x81\x26\x87\x78\xd0\x8d\x75\x54\x00\x00\x00"
+        "\x10\x74\x52\x4e\x53\x69\x76\xeb\xfc\xc3\x27\xf5\x93\x17\x65\x27\x4b\xa9\x82\x9b\x44\x38\x4b\xe8"
+        "\x9f\x00\x00\x00\x11\x49\x44\x41\x54\x78\xda\x01\x2a\x00\xd5\xff\x03\x00\x0f\x7c\x2e\x62\x44\x04"
+        "\xee\xf8\x4c\xe4\xf8\x1e\x00\x00\x00\x11\x49\x44\x41\x54\xac\x6d\xa9\x00\x00\xe8\xc6\x62\x22\x2b"
+        "\x40\x02\x9b\xf1\x9d\xdd\xc5\x91\xa8\xdf\x36\x00\x00\x00\x11\x49\x44\x41\x54\xb0\x03\xab\xc8\xcd"
+        "\xfe\x5d\x6b\x02\xbe\x33\x33\xce\x78\xc0\x72\x4d\xd5\xf7\xaa\xd3\x00\x00\x00\x02\x49\x44\x41\x54"
+        "\x13\x5e\x91\xc7\x80\xdb\x00\x00\x00\x00\x49\x45\x4e\x44\xae\x42\x60\x82"),
+    // Gray+alpha 8-bit
+    PNG_CASE(5, 5, 0xd0edf11a42ac1e27ull,
+        "\x89\x50\x4e\x47\x0d\x0a\x1a\x0a\x00\x00\x00\x0d\x49\x48\x44\x52\x00\x00\x00\x05\x00\x00\x00\x05"
+        "\x08\x04\x00\x00\x00\x27\x66\xee\x6e\x00\x00\x00\x13\x49\x44\x41\x54\x78\xda\x63\x91\xe8\x67\x00"
+        "\x82\xf4\x9f\x09\x92\x8c\x89\xfb\x41\xcc\x13\x51\x06\xd6\x4c\xb2\x00\x00\x00\x13\x49\x44\x41\x54"
+        "\x2b\xcf\x32\xba\x4d\xda\xd4\xee\x69\xb7\xa1\x76\xdf\x1e\x86\x19\x4d\xad\xe7\x2c\xa4\x73\xd4\x00"
+        "\x00\x00\x13\x49\x44\x41\x54\xab\x66\x7d\x3f\x69\x1b\xca\x18\xa4\x26\x71\x83\xed\x25\x48\x11\x00"
+        "\x05\x80\x50\x94\xf0\x63\x00\x00\x00\x02\x49\x44\x41\x54\x13\xaa\x2b\x17\xb6\xde\x00\x00\x00\x00"
+        "\x49\x45\x4e\x44\xae\x42\x60\x82"),
+    // Rgba 8-bit, interlaced
+    PNG_CASE(12, 10, 0xa5c60c63ca4f3750ull,
+        "\x89\x50\x4e\x47\x0d\x0a\x1a\x0a\x00\x00\x00\x0d\x49\x48\x44\x52\x00\x00\x00\x0c\x00\x00\x00\x0a"
+        "\x08\x06\x00\x00\x01\xf7\x2b\x8f\x6c\x00\x00\x00\x9a\x49\x44\x41\x54\x78\xda\x63\x59\xaf\xb7\xb8"
+        "\x4a\xeb\x48\x78\x1b\x53\xef\x4c\x37\xa5\x26\x86\x4b\x66\x0c\xff\xfb\x76\x38\x30\xbc\xab\x78\xf2"
+        "\x8a\xd1\xec\xf3\xbb\xa3\x27\xb2\xc4\xae\x75\x9e\x4b\x9b\xc6\x08\x52\x28\x3a\xcf\x31\x59\x54\x4d"
+        "\x4c\x99\xc9\x5f\x3f\x51\x31\xd6\x55\xe8\xe4\xbc\xa0\xdb\xaf\x59\x4e\xc6\x3f\x70\xb5\x9a\x7a\x2d"
+        "\x6c\x9a\x7e\xce\x5e\x66\xe6\xa9\x4a\x99\xa5\x4b\x12\x82\xcd\x1b\xe7\xde\x14\xf4\xdd\x18\xaf\x9a"
+        "\xca\x67\xfe\xda\x7a\x4b\x27\xb3\xfb\x99\x70\xbf\x97\x53\xfe\xfc\x9b\x35\xd3\xe8\x89\xb6\x58\x8c"
+        "\xa3\x8e\x76\x7c\x57\xb0\x34\xd7\x52\x16\x90\xc1\x82\x31\x5c\x4b\xd7\x2d\xbd\x9b\x60\x78\x67\xfb"
+        "\x44\xab\xe7\xc7\xa9\x17\x48\x00\x00\x00\x9a\x49\x44\x41\x54\x3b\x3f\x30\x00\x01\x93\x9f\xc5\x9f"
+        "\x97\xd7\xd7\x06\x38\xdc\x99\x35\xf1\xdd\xea\x7d\xb7\x62\xcf\xe7\xa7\xbc\xbf\xf0\x21\xc6\x9c\xa1"
+        "\xe1\xce\x1f\xe7\x7f\xb1\x2c\xb3\x41\x38\xe8\x96\xa9\xca\xf5\xff\x4f\x22\x2a\xec\xa6\x4d\x63\xf4"
+        "\x10\xcb\x68\xba\x1f\xb4\xa2\x7a\xf1\x73\xb9\xb0\xcb\x6d\x6f\x7c\x24\xff\xef\xce\x02\x19\xc5\xbc"
+        "\x79\x92\xf7\x8c\x3b\x9d\xbb\xf8\x4f\x1e\xdd\x3a\xe1\x3e\x7f\xe4\x99\x05\x16\x1f\xd5\xae\xb4\x9c"
+        "\xd0\x65\x14\x61\x70\x28\x67\x80\x82\xd6\xa4\x36\xbe\x9b\xf3\xec\x45\x2b\xfb\xe6\x3c\xe2\x78\x75"
+        "\x77\xd2\x7d\xd5\x79\x7f\x27\x26\xed\x96\x63\x40\x02\x2c\x6f\x35\xfc\x37\x6d\x5a\xbf\xc1\x91\xff"
+        "\x7e\x47\x6c\x05\xf0\x00\x00\x00\x9a\x49\x44\x41\x54\x7c\x71\x56\xb2\x4e\xfb\xa4\x27\xb1\x0a\xe7"
+        "\xf9\xf2\xc2\x80\x72\x20\xcc\x10\xfe\xd9\x82\xe1\xff\xcc\x39\x2e\x67\xc5\x1f\x35\x55\xd7\xd7\xdf"
+        "\x67\xe8\xef\xdc\xd7\xd4\x9a\xfa\xa0\x2e\xbe\xb6\xc2\x0f\x19\x33\x7d\x2e\x7b\xba\x5f\x64\x5a\xb9"
+        "\xad\x64\x62\xb2\xda\xbe\xe8\xa7\xad\xcc\x66\x9b\xf3\x85\xf7\xac\x63\xd8\xf5\x3a\xd8\x09\x86\x37"
+        "\x4d\x0c\x0a\x57\x32\x3f\xf2\x3b\x75\x96\x83\xd8\xf7\x85\xd2\xc7\x74\x82\x0a\xcf\xa7\x7c\x8a\xcd"
+        "\x47\xc6\x0c\x85\x8a\x9b\x1b\x03\x97\xf6\xbc\xf4\x6c\xfa\x9a\xd5\x56\xb9\x78\x9f\x50\x6a\xec\xb9"
+        "\xa0\xbe\xe5\x07\x90\xf1\x1e\xaf\x1d\x2b\x35\x1f\x95\x46\x49\x4c\x6f\x9c\x07\x00\x5b\xf9\xe0\xfe"
+        "\xad\x70\x73\x00\x00\x00\x01\x49\x44\x41\x54\x19\x4c\x53\xd5\x28\x00\x00\x00\x00\x49\x45\x4e\x44"
+        "\xae\x42\x60\x82"),
+    // Rgba 16-bit
+    PNG_CASE(8, 6, 0x236a52ec867d3843ull,
+        "\x89\x50\x4e\x47\x0d\x0a\x1a\x0a\x00\x00\x00\x0d\x49\x48\x44\x52\x00\x00\x00\x08\x00\x00\x00\x06"
+        "\x10\x06\x00\x00\x00\xae\x95\x03\xb8\x00\x00\x00\x74\x49\x44\x41\x54\x78\xda\x63\x62\x0c\xdb\xba"
+        "\x77\x76\xb3\x59\x29\x3a\x1d\x68\xee\xf2\x97\xdd\xb2\x66\xbb\x4f\xd1\xb3\x6b\x86\xbc\x0a\x33\xbd"
+        "\x44\xbb\xe4\xce\x9e\x69\xf7\x62\x7d\x24\xb3\x77\x73\xdc\x63\xe3\x3f\xe1\xf5\xd6\x21\xed\x0c\x26"
+        "\x4c\xa2\x86\x59\x87\x0b\xd3\x67\x66\xa0\xd3\x4d\xa1\x4a\x5a\x67\x13\xef\x6e\x0e\xfa\x6a\x75\x21"
+        "\x63\xfd\x0f\xab\x55\x73\x2b\x95\x3e\x7b\x44\xb8\xbd\x0c\xe5\x2d\x37\xf1\x2b\x9b\x59\x1e\xb1\x6d"
+        "\x8d\x61\x50\xd9\x6e\x66\x8e\x39\x06\x77\x96\x06\xcb\xc0\xed\x03\x0b\x00\x00\x00\x74\x49\x44\x41"
+        "\x54\x27\xb2\x19\x45\x3e\x6c\xc9\xbc\xfb\xaf\x7e\xa9\xcc\xe1\x6d\x6a\x31\x9f\x17\x56\x4a\xeb\xff"
+        "\xb4\x30\xb7\xb8\x7e\x3d\xf4\xe1\xad\xb2\x0e\x23\xb6\xf9\xaa\xea\x86\xd2\xb2\xe2\x77\x19\x35\x15"
+        "\xde\x9d\xf3\x39\x2d\x7d\x54\xf9\xb8\xfc\x76\xdb\x9d\x2c\x22\xdf\x24\x76\xcc\x77\xe8\xe2\x7e\xf6"
+        "\x7c\x63\x59\xf7\x34\xa7\x7f\x92\x66\xfc\x05\x8f\x7f\x71\x30\xef\x4f\xbf\x6e\x3b\xf7\xd3\xee\x17"
+        "\x4c\x53\xe6\x9c\x5f\x7a\xfa\x3f\xc7\x05\xe7\xc5\x77\x4a\x8e\x4b\xdc\x63\x40\x03\x2c\xb4\x17\x94"
+        "\x53\x00\x00\x00\x74\x49\x44\x41\x54\x3c\x7e\x6f\xc4\x5f\x08\x45\x48\x75\x2e\xc8\x92\xa9\x5a\x5b"
+        "\xc0\x7c\x55\x35\x5d\x8c\x3d\x6e\x75\x79\x81\x2a\xc3\x4d\x86\x2b\x40\x15\xe7\x19\xb8\x7e\xce\x64"
+        "\x48\x62\x60\x70\xd3\xab\xbd\xc4\xc0\x90\x9d\xcc\xf7\x76\xb7\xe5\x6a\xe9\xc5\xcf\xed\x67\x14\x26"
+        "\x5c\x52\x64\x4c\x2f\x9c\xbc\x40\x7a\x21\x93\xb5\xf7\xa2\x8c\xb5\xa2\xb1\x3f\x33\xd6\xa4\x31\xbd"
+        "\x69\x3c\xd2\x75\x9c\x01\x07\xb8\x64\x77\xc1\x4a\xd2\x6d\xf9\x96\x15\x59\xf6\x05\x5f\x32\x6c\xb3"
+        "\x00\x5d\x20\x9a\x4e\x3b\x3f\x4d\x12\x00\x00\x00\x00\x49\x45\x4e\x44\xae\x42\x60\x82"),
+    // Gray 8-bit, dynamic
+    PNG_CASE(32, 16, 0xcd22e5c7f4e4fb05ull,
+        "\x89\x50\x4e\x47\x0d\x0a\x1a\x0a\x00\x00\x00\x0d\x49\x48\x44\x52\x00\x00\x00\x20\x00\x00\x00\x10"
+        "\x08\x00\x00\x00\x00\x52\x6b\x22\x85\x00\x00\x00\x93\x49\x44\x41\x54\x78\xda\x85\xd1\x31\x15\xc3"
+        "\x30\x0c\x04\x50\x39\x36\x82\x60\xd0\x60\x04\xc6\xa0\xc1\x08\x8a\x41\x43\x10\x64\x08\x02\x0d\xc2"
+        "\x50\x04\x1e\x82\xa1\x08\x3c\x08\x43\x31\x34\x71\x57\xeb\xe5\x34\xfc\xf5\x9e\x0e\xe0\x21\x81\x11"
+        "\x31\xe3\xc8\x94\x85\x36\x3d\x3b\xa0\x4b\xdc\x8d\x8f\xf5\x5d\xc8\x23\x01\x56\xd1\xa6\x2e\xd0\x18"
+        "\xbb\x90\x4f\x60\x33\xeb\x36\x32\x65\xd1\xd3\x20\xd7\xcd\x25\xf2\x8b\x77\xc5\x42\x1e\x89\x2a\x51"
+        "\xaf\xe8\x02\x9d\x1a\x0a\xb0\x4b\xe8\xaa\x32\xce\x61\xb1\xeb\x61\x7c\xb7\x71\x88\xab\x7d\x0f\xc1"
+        "\xf2\xf1\x48\x7a\x2d\x96\xff\xc3\x4d\x01\x96\x76\xcf\xe2\xf2\x03\xa1\x54\xca\xed\xd4\x6f\x1a\x65"
+        "\x00\x00\x00\x00\x49\x45\x4e\x44\xae\x42\x60\x82")
+};
+
+static void TestPng()
+{
+    for (const auto &c : Pngs)
+    {
+        const std::string data(c.data, c.size);
+
+        Imm2dDecodedImage image;
+        CHECK(imm2d_DecodePng(data, image));
+        CHECK(image.width == c.width && image.height == c.height);
+        CHECK(Hash(image.pixels) == c.hash);
+
+        CheckEveryDamagedCopy(data);
+    }
+}
+
+
+//
+// .bmp
+//
+
+static std::string MakeBmp(int width, int height, int bitsPerPixel, const std::string &palette, const std::string &rows)
+{
+    std::string bmp(54, '\0');
+    const auto put = [&bmp](size_t at, uint32_t v, int bytes) { for (int i = 0; i < bytes; ++i) bmp[at + i] = char(v >> (i * 8)); };
+
+    bmp[0] = 'B'; bmp[1] = 'M';
+    put(2, uint32_t(54 + palette.size() + rows.size()), 4);
+    put(10, uint32_t(54 + palette.size()), 4);
+    put(14, 40, 4);
+    put(18, uint32_t(width), 4);
+    put(22, uint32_t(height), 4);
+    put(26, 1, 2);
+    put(28, uint32_t(bitsPerPixel), 2);
+    put(46, uint32_t(palette.size() / 4), 4);
+    return bmp + palette + rows;
+}
+
+static void TestBmp()
+{
+    // 24-bit rows are stored bottom-up, in blue-green-red order, padded to 4 bytes
+    const std::string rows24 =
+        std::string("\x01\x02\x03" "\x04\x05\x06" "\x07\x08\x09" "\0\0\0", 12) +
+        std::string("\x10\x20\x30" "\x40\x50\x60" "\x70\x80\x90" "\0\0\0", 12);
+
+    Imm2dDecodedImage image;
+    CHECK(imm2d_DecodeBmp(MakeBmp(3, 2, 24, "", rows24), image));
+    CHECK(image.width == 3 && image.height == 2);
+    CHECK((image.pixels == std::vector<uint32_t>{ 0xFF302010, 0xFF605040, 0xFF908070, 0xFF030201, 0xFF060504, 0xFF090807 }));
+
+    // A negative height means top-down (and 32-bit rows never need padding)
+    const std::string rows32("\x01\x02\x03\xFF" "\x04\x05\x06\xFF", 8);
+    CHECK(imm2d_DecodeBmp(MakeBmp(1, -2, 32, "", rows32), image));
+    CHECK((image.pixels == std::vector<uint32_t>{ 0xFF030201, 0xFF060504 }));
+
+    // Indexes past the end of the palette come out black
+    const std::string palette("\x00\x00\xFF\x00" "\x00\xFF\x00\x00", 8);
+    CHECK(imm2d_DecodeBmp(MakeBmp(3, 1, 8, palette, std::string("\x01\x00\x07\x00", 4)), image));
+    CHECK((image.pixels == std::vector<uint32_t>{ 0xFF00FF00, 0xFFFF0000, 0xFF000000 }));
+
+    CHECK(!imm2d_DecodeBmp(MakeBmp(3, 2, 16, "", rows24), image));
+    CheckEveryDamagedCopy(MakeBmp(3, 2, 24, "", rows24));
+    CheckEveryDamagedCopy(MakeBmp(3, 1, 8, palette, std::string("\x01\x00\x07\x00", 4)));
+}
+
+
+// Broken copies kept in corpus/ (cut short or with a byte flipped) of the pictures above,
+// for a fuzzer to start from; each one is also checked on its own here
+static void TestCorpus()
+{
+    int files = 0;
+    for (const auto &entry : std::filesystem::directory_iterator("corpus"))
+    {
+        CheckDamaged(ReadAll(entry.path().string().c_str()));
+        ++files;
+    }
+    CHECK(files > 0);
+}
+
+// How long decoding the littleGame pictures takes, so a slower decoder shows up
+static void TimeDecoding()
+{
+    std::vector<std::string> files;
+    size_t bytes = 0;
+    for (const auto &c : Gifs)
+    {
+        files.push_back(ReadAll(("../exampleData/littleGame/" + std::string(c.name)).c_str()));
+        bytes += files.back().size();
+    }
+
+    const int repeats = 2000;
+    const auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeats; ++r)
+    {
+        for (const auto &data : files)
+        {
+            Imm2dDecodedImage image;
+            CHECK(imm2d_DecodeImage(data, image));
+        }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::printf("decoding: %.2f us per file, %.1f MB/s\n",
+        seconds * 1e6 / (double(repeats) * files.size()), double(repeats) * bytes / seconds / 1e6);
+}
+
+void run()
+{
+    TestGif();
+    TestPng();
+    TestBmp();
+    TestCorpus();
+    TimeDecoding();
+
+    // The whole way through LoadImage, a file that stops partway is just an image that never loads
+    const std::string coin = ReadAll("../exampleData/littleGame/coin.gif");
+    FILE *f = std::fopen("build/truncated.gif", "wb");
+    CHECK(f != nullptr);
+    if (f)
+    {
+        std::fwrite(coin.data(), 1, coin.size() / 2, f);
+        std::fclose(f);
+    }
+
+    const Image good = LoadImage("../exampleData/littleGame/coin.gif");
+    CHECK(IsImageReady(good) && ImageWidth(good) == 10 && ImageHeight(good) == 10);
+
+    const Image truncated = LoadImage("build/truncated.gif");
+    CHECK(!IsImageReady(truncated) && ImageWidth(truncated) == 0);
+
+    FinishTest();
+}
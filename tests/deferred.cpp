@@ -0,0 +1,133 @@
+// Deferred drawing (with its merging, and each thread's own list) has to end up with
+// exactly the same pixels as drawing everything right away.
+
+#include "test.h"
+
+#include <chrono>
+#include <thread>
+
+static Image smile = InvalidImage, wall = InvalidImage;
+
+// A bit of everything, including see-through colors drawn over each other (whose
+// order matters) and neighboring pixels and stacked rectangles (which get merged)
+static void DrawScene(int seed)
+{
+    const Color see = MakeColor(200, 40, 90, 128), through = MakeColor(20, 180, 250, 77);
+
+    for (int x = 0; x < 40; ++x)
+    {
+        DrawPixel(x + seed, 3, Red);
+        DrawPixel(x + seed, 3, see);
+        DrawPixel(40 - x, 4 + x % 3, through);
+    }
+
+    const PixelPoint points[] = { { 5, 50, Yellow }, { 6, 50, see }, { 5, 50, through }, { 300, 500, White } };
+    DrawPixels(points, 4);
+
+    DrawHorizontalSpan(2, 60, 100, see);
+    const Color colors[] = { Red, see, Green, through, Blue };
+    DrawHorizontalSpan(-2, 61, colors, 5);
+
+    for (int i = 0; i < 5; ++i) DrawRectangle(10 + i, 70, 30, 20, i % 2 ? see : through, i == 4 ? White : Transparent);
+    DrawRectangle(0, 0, Width, Height / 8, MakeColor(0, 0, 0, 30));
+
+    DrawLine(3, 100, 150 + seed, 130, 1, see);
+    DrawLine(3, 110, 150, 140 - seed, 5, White);
+    DrawCircle(60, 150, 20 + seed, through, Red);
+    DrawArc(120, 150, 25, 4, see, 0.5f, 4.0f);
+
+    DrawString(10, 190, "Hello, deferred!", PixelFont, 10, see);
+    DrawImage(200, 20, smile);
+
+    const SpriteInstance sprites[] = { { 220, 20, wall }, { 225, 25, smile }, { 230, 30, wall } };
+    DrawSprites(sprites, 3);
+}
+
+// The same rows each thread draws below, one pixel at a time
+static void DrawRows(int first, int step)
+{
+    for (int y = first; y < Height; y += step)
+        for (int x = 0; x < Width; ++x)
+            DrawPixel(x, y, MakeColor(uint8_t(x), uint8_t(y), uint8_t(x ^ y), uint8_t(64 + (x + y) % 192)));
+}
+
+static std::vector<uint32_t> DrawRowsOnThreads(int threads)
+{
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) workers.emplace_back(DrawRows, t, threads);
+    for (auto &w : workers) w.join();
+
+    Present();
+    return CopyScreen();
+}
+
+void run()
+{
+    smile = LoadImage("../exampleData/littleGame/smile.gif");
+    wall = LoadImage("../exampleData/littleGame/wall.gif");
+    CHECK(IsImageReady(smile) && IsImageReady(wall));
+
+    for (int seed = 0; seed < 3; ++seed)
+    {
+        Clear(Blue);
+        DrawScene(seed);
+        const auto immediate = CopyScreen();
+
+        UseDeferredDrawing(true);
+        Clear(Blue);
+        DrawScene(seed);
+        CHECK(DeferredCommandCount() > 0);
+        Present();
+        CHECK(DeferredCommandCount() == 0);
+        CHECK(CopyScreen() == immediate);
+
+        // A Clear throws away everything recorded before it
+        DrawScene(seed + 1);
+        Clear(Blue);
+        DrawScene(seed);
+        Present();
+        CHECK(CopyScreen() == immediate);
+        UseDeferredDrawing(false);
+    }
+
+    // How long the rows take drawn right away, one pixel at a time
+    const int repeats = 20;
+    double ms = 0;
+    for (int r = 0; r < repeats; ++r)
+    {
+        Clear();
+        const auto start = std::chrono::steady_clock::now();
+        DrawRows(0, 1);
+        ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    std::printf("DrawPixel: %.1f ns per pixel drawn right away\n", ms * 1e6 / (double(repeats) * Width * Height));
+    const auto immediate = CopyScreen();
+
+    // And read back one at a time
+    auto start = std::chrono::steady_clock::now();
+    bool same = true;
+    for (int r = 0; r < repeats; ++r)
+        for (int y = 0; y < Height; ++y)
+            for (int x = 0; x < Width; ++x) same = same && ReadPixel(x, y) == immediate[size_t(y) * Width + x];
+    ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    CHECK(same);
+    std::printf("ReadPixel: %.1f ns per pixel\n", ms * 1e6 / (double(repeats) * Width * Height));
+
+    // Each thread's rows come out the same as drawing all of them on this one.  (None of
+    // them draw over each other, so the order between threads doesn't matter.)
+
+    UseDeferredDrawing(true);
+    const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    for (int threads = 1; threads <= int(std::max(4u, cores)); threads *= 2)
+    {
+        Clear();
+        start = std::chrono::steady_clock::now();
+        CHECK(DrawRowsOnThreads(threads) == immediate);
+
+        ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::printf("%2d thread(s): %.1f ms for %d deferred pixels\n", threads, ms, Width * Height);
+    }
+    UseDeferredDrawing(false);
+
+    FinishTest();
+}
@@ -0,0 +1,124 @@
+// Finding images by name: the XXH64 hash the names are looked up by, and LoadImage
+// handing back the same Image for the same name (or the same Base64 data).
+
+#include "test.h"
+
+#include <chrono>
+#include <string>
+
+static uint64_t Hash(const std::string &s) { return imm2d_Hash(s.data(), s.size()); }
+
+static std::string Base64(const std::string &bytes)
+{
+    static const char Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for (size_t i = 0; i < bytes.size(); i += 3)
+    {
+        uint32_t v = uint32_t(uint8_t(bytes[i])) << 16;
+        if (i + 1 < bytes.size()) v |= uint32_t(uint8_t(bytes[i + 1])) << 8;
+        if (i + 2 < bytes.size()) v |= uint8_t(bytes[i + 2]);
+
+        out += Alphabet[(v >> 18) & 63];
+        out += Alphabet[(v >> 12) & 63];
+        out += i + 1 < bytes.size() ? Alphabet[(v >> 6) & 63] : '=';
+        out += i + 2 < bytes.size() ? Alphabet[v & 63] : '=';
+    }
+    return out;
+}
+
+static void TestHash()
+{
+    // Published XXH64 values (seed 0)
+    CHECK(Hash("") == 0xEF46DB3751D8E999ull);
+    CHECK(Hash("a") == 0xD24EC4F1A98C6E5Bull);
+    CHECK(Hash("abc") == 0x44BC2CF5AD770999ull);
+    CHECK(Hash("Nobody inspects the spammish repetition") == 0xFBCEA83C8A378BF1ull);
+
+    // Every way the input can be split up (32-byte stripes, then 8, 4, and 1-byte pieces),
+    // from a separate implementation of the XXH64 spec that matches the values above
+    static const struct { size_t length; uint64_t hash; } Expected[] =
+    {
+        { 0, 0xEF46DB3751D8E999ull }, { 1, 0x2078E1AD38AD738Bull }, { 3, 0xBDEF762E8804C53Eull },
+        { 4, 0x6BB99866CB63C0A8ull }, { 5, 0x94B826C2DBB0FE8Eull }, { 7, 0x31365618AD874893ull },
+        { 8, 0x3BA000679FBEE7B5ull }, { 9, 0xC7684EA3EE9E6072ull }, { 15, 0xA3666D452D79E70Dull },
+        { 16, 0x201BD74388E1FAE2ull }, { 17, 0xD7AB41F8A7F2FA16ull }, { 31, 0x7231380363BB4388ull },
+        { 32, 0x56699A69DA28FD3Bull }, { 33, 0xD477447593124012ull }, { 63, 0x8898CD8219F457FCull },
+        { 64, 0xBAD331060E4CD79Aull }, { 65, 0x693DDD997DBE1542ull }, { 100, 0xFB443E08EF7B1EF3ull },
+        { 200, 0x79A2CF6DB616DF43ull },
+    };
+
+    std::string text;
+    for (int i = 0; i < 200; ++i) text += char((i * 7 + 13) & 0xFF);
+    for (const auto &e : Expected) CHECK(Hash(text.substr(0, e.length)) == e.hash);
+}
+
+void run()
+{
+    TestHash();
+
+    const char *coinName = "../exampleData/littleGame/coin.gif";
+    const CacheStats before = ImageCacheStats();
+
+    const Image coin = LoadImage(coinName);
+    CHECK(coin != InvalidImage);
+    CHECK(LoadImage(coinName) == coin);
+    CHECK(LoadImage(std::string(coinName).c_str()) == coin);
+
+    const Image wall = LoadImage("../exampleData/littleGame/wall.gif");
+    CHECK(wall != InvalidImage && wall != coin);
+
+    const CacheStats after = ImageCacheStats();
+    CHECK(after.misses - before.misses == 2);
+    CHECK(after.hits - before.hits == 2);
+    CHECK(after.entries - before.entries == 2);
+
+    // The same Base64 data is the same image, too
+    std::string bytes;
+    CHECK(imm2d_ReadFile(coinName, bytes));
+    const std::string base64 = Base64(bytes);
+    const Image fromBase64 = LoadImage(base64.c_str());
+    CHECK(fromBase64 != InvalidImage && fromBase64 != coin);
+    CHECK(LoadImage(base64.c_str()) == fromBase64);
+    CHECK(ImageWidth(fromBase64) == 10 && ImageHeight(fromBase64) == 10);
+
+    // Names that can't be loaded aren't remembered, so they're tried again each time
+    CHECK(LoadImage("no such file.png") == InvalidImage);
+    CHECK(LoadImage("no such file.png") == InvalidImage);
+
+    // After unloading, the same name loads again (maybe into the same handle)
+    UnloadImage(wall);
+    const Image wallAgain = LoadImage("../exampleData/littleGame/wall.gif");
+    CHECK(wallAgain != InvalidImage && IsImageReady(wallAgain) && ImageWidth(wallAgain) == 10);
+    CHECK(LoadImage("../exampleData/littleGame/wall.gif") == wallAgain);
+    CHECK(LoadImage(coinName) == coin);
+
+    // Two names with the same hash are still different images.  (Real XXH64 collisions
+    // are hard to come by, so this one is made by hand.)
+    const std::string other = "../exampleData/littleGame/door.gif";
+    {
+        std::lock_guard<std::mutex> lock(imm2d_mediaLock);
+        imm2d_imagesByName.emplace(Hash(other), coin);
+    }
+    const Image door = LoadImage(other.c_str());
+    CHECK(door != InvalidImage && door != coin);
+    CHECK(LoadImage(other.c_str()) == door);
+    CHECK(LoadImage(coinName) == coin);
+    {
+        std::lock_guard<std::mutex> lock(imm2d_mediaLock);
+        const auto matches = imm2d_imagesByName.equal_range(Hash(other));
+        for (auto found = matches.first; found != matches.second; ++found)
+            if (found->second == coin) { imm2d_imagesByName.erase(found); break; }
+    }
+
+    // And how long it takes to find an image that's already loaded
+    const CacheStats start = ImageCacheStats();
+    const auto t0 = std::chrono::steady_clock::now();
+    bool same = true;
+    for (int i = 0; i < 100000; ++i) same = same && LoadImage(coinName) == coin;
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    CHECK(same);
+    CHECK(ImageCacheStats().hits - start.hits == 100000);
+    std::printf("100000 repeated loads: %.1f ms\n", ms);
+
+    FinishTest();
+}
@@ -0,0 +1,168 @@
+// Hard-edged (not anti-aliased) lines, against a plain Bresenham that walks every step
+// and a "which pixels are close enough to the line" check.  Many of these lines start
+// or end far off the screen, to check the clipping.
+
+#include "test.h"
+
+#include <chrono>
+
+static uint32_t seed = 1;
+static int Random(int lo, int hi)
+{
+    seed = seed * 1664525u + 1013904223u;
+    return lo + int((seed >> 8) % uint32_t(hi - lo + 1));
+}
+
+// Every step of the line, one at a time, skipping whatever is off the screen
+static std::vector<uint8_t> ReferenceThinLine(int x1, int y1, int x2, int y2)
+{
+    std::vector<uint8_t> hits(size_t(Width) * Height, 0);
+
+    const bool steep = std::abs(y2 - y1) > std::abs(x2 - x1);
+    const int64_t majorLength = steep ? std::abs(y2 - y1) : std::abs(x2 - x1);
+    const int64_t minorLength = steep ? std::abs(x2 - x1) : std::abs(y2 - y1);
+    const int majorStep = (steep ? y2 >= y1 : x2 >= x1) ? 1 : -1, minorStep = (steep ? x2 >= x1 : y2 >= y1) ? 1 : -1;
+
+    for (int64_t i = 0; i <= majorLength; ++i)
+    {
+        // Halfway between two pixels rounds away from the start
+        const int64_t minor = majorLength > 0 ? (2 * i * minorLength + majorLength) / (2 * majorLength) : 0;
+        const int64_t x = steep ? x1 + minorStep * minor : x1 + majorStep * i;
+        const int64_t y = steep ? y1 + majorStep * i : y1 + minorStep * minor;
+        if (x >= 0 && x < Width && y >= 0 && y < Height) ++hits[size_t(y) * Width + size_t(x)];
+    }
+    return hits;
+}
+
+static double DistanceToSegment(double px, double py, double x1, double y1, double x2, double y2)
+{
+    const double dx = x2 - x1, dy = y2 - y1, lengthSquared = dx * dx + dy * dy;
+    const double t = lengthSquared > 0 ? std::max(0.0, std::min(1.0, ((px - x1) * dx + (py - y1) * dy) / lengthSquared)) : 0;
+    return std::hypot(px - (x1 + t * dx), py - (y1 + t * dy));
+}
+
+// The rasterizers these replaced, for timing against: the thin one takes every step
+// (even off the screen), and the thick one checks every pixel in the line's bounding box
+static void OldThinLine(float x1, float y1, float x2, float y2, Color c)
+{
+    const float dx = x2 - x1, dy = y2 - y1;
+    const int steps = static_cast<int>(std::ceil(std::max(std::fabs(dx), std::fabs(dy))));
+
+    for (int i = 0; i <= steps; ++i)
+    {
+        const float t = steps == 0 ? 0.0f : float(i) / steps;
+        imm2d_BlendPixel(int(std::floor(x1 + dx * t + 0.5f)), int(std::floor(y1 + dy * t + 0.5f)), c);
+    }
+}
+
+static void OldThickLine(float x1, float y1, float x2, float y2, float thickness, Color c)
+{
+    if (thickness <= 1.0f) { OldThinLine(x1, y1, x2, y2, c); return; }
+
+    const float r = thickness / 2;
+    const int left = std::max(0, int(std::floor(std::min(x1, x2) - r)));
+    const int right = std::min(Width - 1, int(std::ceil(std::max(x1, x2) + r)));
+    const int top = std::max(0, int(std::floor(std::min(y1, y2) - r)));
+    const int bottom = std::min(Height - 1, int(std::ceil(std::max(y1, y2) + r)));
+
+    const float dx = x2 - x1, dy = y2 - y1;
+    const float lengthSquared = dx * dx + dy * dy;
+
+    for (int y = top; y <= bottom; ++y)
+        for (int x = left; x <= right; ++x)
+        {
+            float t = lengthSquared > 0 ? ((x - x1) * dx + (y - y1) * dy) / lengthSquared : 0.0f;
+            t = std::min(1.0f, std::max(0.0f, t));
+
+            const float ex = x - (x1 + dx * t), ey = y - (y1 + dy * t);
+            if (ex * ex + ey * ey <= r * r) imm2d_BlendPixel(x, y, c);
+        }
+}
+
+// How long the same lines take with the old rasterizers and the new.  Their ends are
+// up to "far" pixels off the screen.
+static void TimeLines(const char *what, int minThickness, int maxThickness, int far, Color c)
+{
+    struct Line { int x1, y1, x2, y2, thickness; };
+    std::vector<Line> lines(2000);
+    for (auto &l : lines)
+    {
+        l.x1 = Random(-far, Width - 1 + far), l.y1 = Random(-far, Height - 1 + far);
+        l.x2 = Random(-far, Width - 1 + far), l.y2 = Random(-far, Height - 1 + far);
+        l.thickness = Random(minThickness, maxThickness);
+    }
+
+    const auto Time = [&](void (*draw)(float, float, float, float, float, Color))
+    {
+        std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+        const auto start = std::chrono::steady_clock::now();
+        for (const auto &l : lines) draw(float(l.x1), float(l.y1), float(l.x2), float(l.y2), float(l.thickness), c);
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    const double before = Time(OldThickLine), after = Time(imm2d_ThickLine);
+    std::printf("%zu %s lines: %.2f ms before, %.2f ms now (%.1fx)\n", lines.size(), what, before, after, before / after);
+}
+
+// Half-white on black, so anything blended twice is easy to spot
+static const Color Half = MakeColor(255, 255, 255, 128);
+
+void run()
+{
+    const uint32_t once = imm2d_Blend(Black, Half);
+
+    // One pixel thick: exactly Bresenham
+    for (int i = 0; i < 3000; ++i)
+    {
+        const int far = i % 3 == 0 ? 5000 : 40;
+        const int x1 = Random(-far, Width + far), y1 = Random(-far, Height + far);
+        const int x2 = i % 7 == 0 ? x1 : Random(-far, Width + far), y2 = i % 11 == 0 ? y1 : Random(-far, Height + far);
+
+        Clear();
+        DrawLine(x1, y1, x2, y2, 1, Half);
+        const auto screen = CopyScreen();
+        const auto expected = ReferenceThinLine(x1, y1, x2, y2);
+
+        bool same = true;
+        for (size_t p = 0; p < screen.size(); ++p) same = same && screen[p] == (expected[p] ? once : uint32_t(Black));
+        if (!same) std::printf("  thin line (%d, %d) to (%d, %d)\n", x1, y1, x2, y2);
+        CHECK(same);
+    }
+
+    // Thicker: every pixel within thickness/2 of the line, each blended once.  (Pixels
+    // right on that edge could go either way with rounding, so those aren't counted.)
+    for (int i = 0; i < 1500; ++i)
+    {
+        const int far = i % 3 == 0 ? 3000 : 20;
+        const int x1 = Random(-far, Width + far), y1 = Random(-far, Height + far);
+        const int x2 = i % 7 == 0 ? x1 : Random(-far, Width + far), y2 = i % 11 == 0 ? y1 : Random(-far, Height + far);
+        const int thickness = Random(2, 25);
+
+        Clear();
+        DrawLine(x1, y1, x2, y2, thickness, Half);
+        const auto screen = CopyScreen();
+
+        bool same = true;
+        for (int y = 0; y < Height; ++y)
+        {
+            for (int x = 0; x < Width; ++x)
+            {
+                const double distance = DistanceToSegment(x, y, x1, y1, x2, y2) - thickness / 2.0;
+                const uint32_t p = screen[size_t(y) * Width + x];
+                if (p != once && p != Black) same = false;
+                else if (distance < -1e-3) same = same && p == once;
+                else if (distance > 1e-3) same = same && p == Black;
+            }
+        }
+        if (!same) std::printf("  line (%d, %d) to (%d, %d), %d thick\n", x1, y1, x2, y2, thickness);
+        CHECK(same);
+    }
+
+    TimeLines("thin", 1, 1, 0, Half);
+    TimeLines("thin opaque", 1, 1, 0, White);
+    TimeLines("thin, mostly off-screen,", 1, 1, 5000, Half);
+    TimeLines("thick", 2, 25, 0, Half);
+    TimeLines("thick opaque", 2, 25, 0, White);
+
+    FinishTest();
+}
@@ -0,0 +1,167 @@
+// DrawRectangle covers exactly width*height pixels with its border on the outermost ring
+// of them, and imm2d_FillPixels (which does the solid ones) gets every pixel from any
+// starting spot, whatever the alignment.
+
+#include "test.h"
+
+#include <climits>
+
+static uint32_t seed = 1;
+static int Random(int lo, int hi)
+{
+    seed = seed * 1664525u + 1013904223u;
+    return lo + int((seed >> 8) % uint32_t(hi - lo + 1));
+}
+
+// What each pixel should be after DrawRectangle on a black screen: the fill blended once
+// everywhere inside, then the stroke blended once on the ring (the parts on the screen)
+static std::vector<uint32_t> Reference(int x, int y, int width, int height, Color fill, Color stroke)
+{
+    std::vector<uint32_t> expected(size_t(Width) * Height, Black);
+    if (width <= 0 || height <= 0) return expected;
+
+    const int64_t left = x, top = y, right = int64_t(x) + width - 1, bottom = int64_t(y) + height - 1;
+    for (int py = 0; py < Height; ++py)
+    {
+        for (int px = 0; px < Width; ++px)
+        {
+            if (px < left || px > right || py < top || py > bottom) continue;
+
+            uint32_t &p = expected[size_t(py) * Width + px];
+            if (fill != Transparent) p = imm2d_Blend(p, fill);
+
+            const bool ring = px == left || px == right || py == top || py == bottom;
+            if (ring && stroke != Transparent) p = imm2d_Blend(p, stroke);
+        }
+    }
+    return expected;
+}
+
+static void Check(int x, int y, int width, int height, Color fill, Color stroke)
+{
+    Clear();
+    DrawRectangle(x, y, width, height, fill, stroke);
+    const bool same = CopyScreen() == Reference(x, y, width, height, fill, stroke);
+    if (!same) std::printf("  rectangle (%d, %d) %dx%d, fill %08X, stroke %08X\n", x, y, width, height, unsigned(fill), unsigned(stroke));
+    CHECK(same);
+}
+
+static int Count(const std::vector<uint32_t> &pixels, uint32_t value)
+{
+    int count = 0;
+    for (const uint32_t p : pixels) count += p == value;
+    return count;
+}
+
+// See-through colors, so anything blended twice (or missed) shows up
+static const Color Fill = MakeColor(200, 40, 90, 128), Stroke = MakeColor(20, 180, 250, 77);
+
+static void TestRectangles()
+{
+    const Color fills[] = { Fill, Transparent, Fill, Red, Transparent, Red };
+    const Color strokes[] = { Transparent, Stroke, Stroke, Stroke, White, White };
+
+    for (size_t k = 0; k < sizeof(fills) / sizeof(fills[0]); ++k)
+    {
+        const Color fill = fills[k], stroke = strokes[k];
+
+        // Single pixels, single rows and columns, and a few small sizes, in the middle
+        // and hanging off every edge
+        for (const int width : { 1, 2, 3, 7, 17 })
+        {
+            for (const int height : { 1, 2, 3, 5 })
+            {
+                for (const int x : { 10, -1, -width + 1, Width - 1, Width - width + 1 })
+                    for (const int y : { 10, -1, -height + 1, Height - 1, Height - height + 1 })
+                        Check(x, y, width, height, fill, stroke);
+            }
+        }
+
+        // Zero and negative sizes draw nothing
+        for (const int width : { 0, -1, -10, INT_MIN })
+        {
+            Check(20, 20, width, 5, fill, stroke);
+            Check(20, 20, 5, width, fill, stroke);
+        }
+
+        // Far past the screen in every direction, including sizes that would overflow
+        Check(-1000, -1000, 2000, 2000, fill, stroke);
+        Check(-5, -5, INT_MAX, INT_MAX, fill, stroke);
+        Check(INT_MAX - 3, 10, INT_MAX, 4, fill, stroke);
+        Check(10, 10, Width, Height, fill, stroke);
+        Check(Width, 0, 5, 5, fill, stroke);
+        Check(0, Height, 5, 5, fill, stroke);
+        Check(-5, 0, 5, 5, fill, stroke);
+
+        // And a lot of random ones
+        for (int i = 0; i < 300; ++i)
+            Check(Random(-40, Width + 10), Random(-40, Height + 10), Random(1, Width + 60), Random(1, Height + 60), fill, stroke);
+    }
+
+    // The counts, spelled out: a solid rectangle is exactly width*height pixels, and its
+    // border (in a different solid color) is the outermost 2*(width + height) - 4 of them
+    for (const auto &size : { std::make_pair(1, 1), std::make_pair(1, 9), std::make_pair(9, 1), std::make_pair(2, 2), std::make_pair(13, 7) })
+    {
+        const int width = size.first, height = size.second;
+
+        Clear();
+        DrawRectangle(30, 40, width, height, Red, Transparent);
+        auto screen = CopyScreen();
+        CHECK(Count(screen, Red) == width * height);
+        CHECK(Count(screen, Black) == Width * Height - width * height);
+
+        Clear();
+        DrawRectangle(30, 40, width, height, Red, White);
+        screen = CopyScreen();
+        const int ring = width == 1 || height == 1 ? width * height : 2 * (width + height) - 4;
+        CHECK(Count(screen, White) == ring);
+        CHECK(Count(screen, Red) == width * height - ring);
+        CHECK(screen[size_t(40) * Width + 30] == White);
+        CHECK(screen[size_t(40 + height - 1) * Width + 30 + width - 1] == White);
+    }
+}
+
+// imm2d_FillPixels stores the first few pixels one at a time until it's aligned, then a
+// vector at a time, then the leftovers one at a time.  Every start and length that moves
+// those boundaries around has to fill exactly what it was asked to.
+static void TestFillPixels()
+{
+    const uint32_t Guard = 0xDEADBEEF, c = 0x80402010;
+
+    std::vector<uint32_t> buffer(128);
+    for (size_t start = 0; start < 8; ++start)
+    {
+        for (size_t count = 0; count <= 80; ++count)
+        {
+            std::fill(buffer.begin(), buffer.end(), Guard);
+            imm2d_FillPixels(buffer.data() + start, count, c);
+
+            bool same = true;
+            for (size_t i = 0; i < buffer.size(); ++i) same = same && buffer[i] == (i >= start && i < start + count ? c : Guard);
+            if (!same) std::printf("  FillPixels from %zu, %zu pixels\n", start, count);
+            CHECK(same);
+        }
+    }
+
+    // Big enough for the streaming stores that skip the cache, starting unaligned, and
+    // with every number of pixels left over after them
+    std::vector<uint32_t> big((size_t(1) << 18) + 64);
+    for (size_t extra = 0; extra < 16; ++extra)
+    {
+        const size_t count = (size_t(1) << 18) + extra;
+        std::fill(big.begin(), big.end(), Guard);
+        imm2d_FillPixels(big.data() + 3, count, c);
+
+        CHECK(big[2] == Guard && big[3] == c);
+        CHECK(big[3 + count - 1] == c && big[3 + count] == Guard);
+        CHECK(Count(big, c) == int(count));
+    }
+}
+
+void run()
+{
+    TestRectangles();
+    TestFillPixels();
+
+    FinishTest();
+}
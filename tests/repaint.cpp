@@ -0,0 +1,71 @@
+// Imm2dRepaintSchedule on its own, with made-up times: the UI thread is only woken when
+// something changes while it's idle, and never repaints more often than MinInterval.
+
+#include "test.h"
+
+using Schedule = Imm2dRepaintSchedule;
+using std::chrono::milliseconds;
+using std::chrono::microseconds;
+
+static const Schedule::Clock::duration Never = Schedule::Clock::duration::max();
+static const Schedule::Clock::duration Now = Schedule::Clock::duration::zero();
+
+void run()
+{
+    // Any time well after the clock's zero point, so the first repaint isn't held back
+    const Schedule::Clock::time_point start = Schedule::Clock::time_point{} + std::chrono::hours(1);
+
+    Schedule s;
+    CHECK(s.untilRepaint(start) == Never);
+
+    // Going from idle to pending wakes the UI thread, once.  It's due right away, since the
+    // last repaint was long ago.
+    CHECK(s.changed());
+    CHECK(!s.changed());
+    CHECK(!s.changed());
+    CHECK(s.untilRepaint(start) == Now);
+
+    s.repainted(start);
+    CHECK(s.untilRepaint(start + milliseconds(1)) == Never);
+
+    // A change right after that repaint wakes the UI thread again, but it has to wait out
+    // the rest of MinInterval
+    CHECK(s.changed());
+    CHECK(s.untilRepaint(start + milliseconds(1)) == milliseconds(4));
+    CHECK(s.untilRepaint(start + milliseconds(5) - microseconds(1)) == microseconds(1));
+    CHECK(s.untilRepaint(start + milliseconds(5)) == Now);
+    CHECK(s.untilRepaint(start + milliseconds(9)) == Now);
+
+    // More changes while it waits neither wake it nor move the time it's due
+    CHECK(!s.changed());
+    CHECK(s.untilRepaint(start + milliseconds(2)) == milliseconds(3));
+
+    s.repainted(start + milliseconds(9));
+    CHECK(s.untilRepaint(start + milliseconds(9)) == Never);
+
+    // After a long quiet spell, a change is due right away again
+    CHECK(s.changed());
+    CHECK(s.untilRepaint(start + milliseconds(30)) == Now);
+    s.repainted(start + milliseconds(30));
+
+    // Something changing every 0.3 ms for a second: a UI thread that repaints as soon as it's
+    // allowed to is woken once per repaint, and never repaints sooner than MinInterval apart
+    Schedule::Clock::time_point now = start + milliseconds(100), last = s.lastRepaint;
+    int wakes = 0, repaints = 0;
+    bool spaced = true;
+    for (int step = 0; step < 3334; ++step, now += microseconds(300))
+    {
+        if (s.changed()) ++wakes;
+        if (s.untilRepaint(now) != Now) continue;
+
+        spaced = spaced && now - last >= Schedule::MinInterval;
+        last = now;
+        s.repainted(now);
+        ++repaints;
+    }
+    CHECK(spaced);
+    CHECK(wakes == repaints || wakes == repaints + 1);
+    CHECK(repaints >= 1000 / 6 && repaints <= 1000 / 5 + 1);
+
+    FinishTest();
+}
@@ -0,0 +1,27 @@
+#!/bin/sh
+#
+# Builds and runs every headless test in this folder (with IMM2D_HEADLESS, so
+# no window is needed).  Uses $CXX if it's set, or c++ otherwise:
+#
+#   tests/runTests.sh
+#
+
+cd "$(dirname "$0")" || exit 1
+mkdir -p build
+
+CXX=${CXX:-c++}
+failed=0
+
+for source in *.cpp; do
+    name=${source%.cpp}
+    echo "== $name"
+
+    if ! $CXX -std=c++17 -O2 -Wall -Wextra -pthread -o "build/$name" "$source"; then
+        failed=1
+        continue
+    fi
+
+    ./build/"$name" || failed=1
+done
+
+exit $failed
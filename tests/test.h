@@ -0,0 +1,31 @@
+// Shared by the headless tests.  Each test is a little program of its own (built by
+// runTests.sh) that draws with the real library into its in-memory screen, so it can
+// reach the imm2d_ internals when it needs to look at something directly.
+//
+// The library calls run() on its own thread, so tests end by calling FinishTest(),
+// which also decides the program's exit code.
+
+#define IMM2D_HEADLESS
+#define IMM2D_IMPLEMENTATION
+#include "../immediate2d.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+static int testFailures = 0;
+
+#define CHECK(condition) do { if (!(condition)) { std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); ++testFailures; } } while (0)
+
+static void FinishTest()
+{
+    std::printf(testFailures ? "FAILED (%d)\n" : "ok\n", testFailures);
+    std::fflush(stdout);
+    std::_Exit(testFailures ? 1 : 0);
+}
+
+// A copy of the whole screen, for comparing one drawing against another
+inline std::vector<uint32_t> CopyScreen()
+{
+    std::lock_guard<std::mutex> lock(imm2d_bitmapLock);
+    return imm2d_pixels;
+}
@@ -0,0 +1,66 @@
+// The window's integer upscaler (SIMD for the common scales) against the obvious
+// pixel-by-pixel version, at the 640x480 size the benchmark below uses.
+
+#define IMM2D_WIDTH 640
+#define IMM2D_HEIGHT 480
+#include "test.h"
+
+#include <chrono>
+
+static uint32_t seed = 1;
+static uint32_t Random()
+{
+    seed = seed * 1664525u + 1013904223u;
+    return seed;
+}
+
+void run()
+{
+    std::vector<uint32_t> source(size_t(Width) * Height);
+    for (auto &p : source) p = Random();
+
+    // Every length (up to a few registers' worth) from an unaligned spot, at every scale
+    for (int scale = 1; scale <= 9; ++scale)
+    {
+        for (int count = 0; count <= 21; ++count)
+        {
+            std::vector<uint32_t> row(size_t(count + 2) * scale, 0xDEADBEEF);
+            imm2d_WidenRow(source.data() + 3, count, row.data() + 1, scale);
+
+            bool same = row[0] == 0xDEADBEEF;
+            for (int i = 0; i < count * scale; ++i) same = same && row[size_t(i) + 1] == source[size_t(3 + i / scale)];
+            for (size_t i = size_t(count) * scale + 1; i < row.size(); ++i) same = same && row[i] == 0xDEADBEEF;
+            CHECK(same);
+        }
+    }
+
+    // Part of the screen lands in the same part of the bigger one, and nothing else changes
+    for (int scale = 1; scale <= 8; ++scale)
+    {
+        const int left = 13, top = 7, right = Width - 5, bottom = 100;
+
+        std::vector<uint32_t> scaled(size_t(Width) * Height * scale * scale, 0xDEADBEEF);
+        imm2d_Upscale(source.data(), scaled.data(), scale, left, top, right, bottom);
+
+        bool same = true;
+        for (int y = 0; y < Height * scale; ++y)
+        {
+            for (int x = 0; x < Width * scale; ++x)
+            {
+                const int sx = x / scale, sy = y / scale;
+                const bool inside = sx >= left && sx < right && sy >= top && sy < bottom;
+                same = same && scaled[size_t(y) * Width * scale + x] == (inside ? source[size_t(sy) * Width + sx] : 0xDEADBEEF);
+            }
+        }
+        CHECK(same);
+
+        // And how long the whole screen takes
+        const auto start = std::chrono::steady_clock::now();
+        const int repeats = 20;
+        for (int r = 0; r < repeats; ++r) imm2d_Upscale(source.data(), scaled.data(), scale, 0, 0, Width, Height);
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / repeats;
+        std::printf("%dx: %.2f ms per %dx%d frame\n", scale, ms, Width, Height);
+    }
+
+    FinishTest();
+}